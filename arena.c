@@ -0,0 +1,84 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGN 16
+
+typedef struct arena_chunk {
+  struct arena_chunk *next;
+  size_t              size, used;
+  unsigned char      *data;
+} arena_chunk;
+
+struct arena {
+  arena_chunk *chunks;
+  size_t       chunk_size;
+};
+
+arena *
+arena_new(size_t chunk_size) {
+  arena *a = calloc(1, sizeof(arena));
+  if(a) a->chunk_size = chunk_size;
+  return a;
+}
+
+static arena_chunk *
+chunk_new(size_t size) {
+  arena_chunk *chunk = malloc(sizeof(arena_chunk));
+  if(chunk == NULL) return NULL;
+
+  chunk->data = aligned_alloc(ARENA_ALIGN, size);
+  if(chunk->data == NULL) {
+    free(chunk);
+    return NULL;
+  }
+  chunk->size = size;
+  chunk->used = 0;
+  chunk->next = NULL;
+  return chunk;
+}
+
+void *
+arena_alloc(arena *a, size_t size) {
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+  arena_chunk *chunk = a->chunks;
+  if(chunk == NULL || chunk->size - chunk->used < size) {
+    size_t chunk_size = (a->chunk_size > size ? a->chunk_size : size);
+    chunk_size = (chunk_size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    chunk = chunk_new(chunk_size);
+    if(chunk == NULL) return NULL;
+    chunk->next = a->chunks;
+    a->chunks = chunk;
+  }
+
+  void *ptr = chunk->data + chunk->used;
+  chunk->used += size;
+  return ptr;
+}
+
+int
+arena_owns(const arena *a, const void *ptr) {
+  uintptr_t p = (uintptr_t)ptr;
+  for(arena_chunk *chunk = a->chunks; chunk; chunk = chunk->next) {
+    uintptr_t base = (uintptr_t)chunk->data;
+    if(p >= base && p < base + chunk->used) return 1;
+  }
+  return 0;
+}
+
+void
+arena_free(arena *a) {
+  if(a == NULL) return;
+
+  arena_chunk *chunk = a->chunks;
+  while(chunk) {
+    arena_chunk *next = chunk->next;
+    free(chunk->data);
+    free(chunk);
+    chunk = next;
+  }
+  free(a);
+}
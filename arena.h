@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stddef.h>
+
+// Bump allocator handing out memory from a few large chunks. Individual
+// allocations are never freed; the whole arena goes at once.
+typedef struct arena arena;
+
+arena * arena_new  (size_t chunk_size);
+void *  arena_alloc(arena *a, size_t size);
+int     arena_owns (const arena *a, const void *ptr);
+void    arena_free (arena *a);
@@ -0,0 +1,135 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "step.h"
+
+typedef struct batch_world {
+  space_params params;
+  cpSpace     *space;
+  int          bodies;
+
+  // Results of the last batch_run.
+  int          steps;
+  uint64_t     ns;
+} batch_world;
+
+struct batch {
+  pool        *pool;
+  batch_world *worlds;
+  int          count;
+
+  // Arguments of the current batch_run, read by the jobs.
+  int          steps;
+  double       dt;
+  uint64_t     budget;
+};
+
+static void
+count_body(cpBody *body, int *count) {
+  if(cpBodyGetType(body) != CP_BODY_TYPE_STATIC) (*count)++;
+}
+
+static void
+build_world(batch *b, int index, int worker) {
+  batch_world *world = &b->worlds[index];
+
+  int width, height;
+  scene_extent(&world->params.scene, &width, &height);
+  world->space = space_new(width, height, &world->params);
+
+  world->bodies = 0;
+  if(world->space) cpSpaceEachBody(world->space, (cpSpaceBodyIteratorFunc)count_body, &world->bodies);
+}
+
+static void
+step_world(batch *b, int index, int worker) {
+  batch_world *world = &b->worlds[index];
+  world->steps = 0;
+  world->ns    = 0;
+  if(world->space == NULL) return;
+
+  uint64_t start = step_now_ns(), now = start;
+  while(world->steps < b->steps && (b->budget == 0 || now - start < b->budget)) {
+    space_update(world->space, b->dt);
+    world->steps++;
+    now = step_now_ns();
+  }
+  world->ns = now - start;
+}
+
+static void
+destroy_world(batch *b, int index, int worker) {
+  batch_world *world = &b->worlds[index];
+  if(world->space) space_destroy(world->space);
+  world->space = NULL;
+}
+
+batch *
+batch_new(pool *p, const space_params *params, int count) {
+  batch *b = calloc(1, sizeof(batch));
+  if(b == NULL) return NULL;
+
+  b->worlds = calloc(count, sizeof(batch_world));
+  if(b->worlds == NULL) {
+    free(b);
+    return NULL;
+  }
+  b->pool  = p;
+  b->count = count;
+  for(int i=0; i<count; i++) {
+    b->worlds[i].params = params[i];
+    b->worlds[i].params.threads = 0;
+    // Worlds are built in parallel and can't share a cache file.
+    b->worlds[i].params.scene.decomp_cache = NULL;
+  }
+
+  pool_run(p, count, (pool_func)build_world, b);
+  return b;
+}
+
+void
+batch_free(batch *b) {
+  if(b == NULL) return;
+
+  pool_run(b->pool, b->count, (pool_func)destroy_world, b);
+  free(b->worlds);
+  free(b);
+}
+
+int
+batch_count(const batch *b) {
+  return b->count;
+}
+
+cpSpace *
+batch_space(const batch *b, int i) {
+  return b->worlds[i].space;
+}
+
+void
+batch_run(batch *b, int steps, double dt, uint64_t budget_ns, batch_stats *stats) {
+  b->steps  = steps;
+  b->dt     = dt;
+  b->budget = budget_ns;
+
+  uint64_t start = step_now_ns();
+  pool_run(b->pool, b->count, (pool_func)step_world, b);
+  uint64_t wall = step_now_ns() - start;
+
+  memset(stats, 0, sizeof(batch_stats));
+  stats->worlds = b->count;
+  stats->wall   = wall;
+  stats->min    = UINT64_MAX;
+  for(int i=0; i<b->count; i++) {
+    const batch_world *world = &b->worlds[i];
+    stats->bodies     += world->bodies;
+    stats->steps      += world->steps;
+    stats->body_steps += (uint64_t)world->bodies*world->steps;
+    stats->busy       += world->ns;
+    if(world->ns < stats->min) stats->min = world->ns;
+    if(world->ns > stats->max) stats->max = world->ns;
+    if(world->space && world->steps < steps) stats->budgeted++;
+  }
+  if(b->count == 0) stats->min = 0;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "pool.h"
+#include "space.h"
+
+// Many independent worlds in one process, built, stepped and torn down in
+// parallel on a pool, one world per job. Meant for parameter sweeps: each
+// world gets its own params and nothing is shared between them.
+typedef struct batch batch;
+
+typedef struct batch_stats {
+  int      worlds;
+  int      bodies;      // summed over all worlds
+  uint64_t steps;       // world steps taken by the run
+  uint64_t body_steps;  // bodies*steps summed over all worlds
+  uint64_t wall;        // ns for the whole run
+  uint64_t busy;        // ns spent stepping, summed over all worlds
+  uint64_t min, max;    // ns spent by the fastest and slowest world
+  int      budgeted;    // worlds stopped by the time budget short of their steps
+} batch_stats;
+
+// World i is built from params[i]. Worlds are plain cpSpaces: the pool
+// already keeps every thread busy, so params[i].threads is ignored.
+batch *   batch_new  (pool *p, const space_params *params, int count);
+void      batch_free (batch *b);
+
+int       batch_count(const batch *b);
+cpSpace * batch_space(const batch *b, int i);
+
+// Step every world up to steps more times, or until it has spent budget_ns
+// on this run when budget_ns isn't 0. The budget is checked between steps,
+// so a world can run over by one step.
+void      batch_run  (batch *b, int steps, double dt, uint64_t budget_ns, batch_stats *stats);
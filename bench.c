@@ -0,0 +1,846 @@
+// Headless step-throughput benchmark, no SDL involved.
+//
+//   $ ./build_bench.sh
+//   $ ./chipmunk_bench -n 5000 -w 200
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "space.h"
+#include "step.h"
+#include "replay.h"
+#include "batch.h"
+#include "contact.h"
+#include "level.h"
+#include "decomp.h"
+
+#define SCREEN_W  640
+#define SCREEN_H  480
+
+// Every run needs its world, so running out of memory building one ends the
+// benchmark.
+static cpSpace *
+new_space(int width, int height, const space_params *params) {
+  cpSpace *space = space_new(width, height, params);
+  if(space == NULL) {
+    fprintf(stderr, "can't build the world\n");
+    exit(1);
+  }
+  return space;
+}
+
+static int
+cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void
+count_body(cpBody *body, int *count) {
+  if(cpBodyGetType(body) != CP_BODY_TYPE_STATIC) (*count)++;
+}
+
+static int
+count_bodies(cpSpace *space) {
+  int count = 0;
+  cpSpaceEachBody(space, (cpSpaceBodyIteratorFunc)count_body, &count);
+  return count;
+}
+
+// Nearest-rank percentile over an already sorted sample array.
+static uint64_t
+percentile(const uint64_t *sorted, int n, double p) {
+  int i = (int)(p/100.0*n + 0.5) - 1;
+  if(i < 0) i = 0;
+  if(i >= n) i = n - 1;
+  return sorted[i];
+}
+
+typedef struct bench_result {
+  int      bodies;
+  int      threads;
+  cpFloat  hash_dim;
+  int      hash_count;
+  uint64_t build;
+  uint64_t total;
+  space_stats stats;
+  uint64_t p50, p90, p99, min, max;
+  int      iter_min, iter_max;
+  double   iter_avg;
+} bench_result;
+
+// Build a world, step it and collect per-step timings into samples. With a
+// replay log the recorded world is built and its input fed in step by step.
+static void
+run(const space_params *params, const replay_log *log, int steps, int warmup, double dt,
+    uint64_t *samples, uint64_t *hashes, bench_result *res) {
+
+  // A replay brings its own size, its scene is already in params (see main).
+  int width, height;
+  if(log) {
+    width  = log->width;
+    height = log->height;
+  } else {
+    scene_extent(&params->scene, &width, &height);
+    width  = cpfmax(width, SCREEN_W);
+    height = cpfmax(height, SCREEN_H);
+  }
+
+  uint64_t build_start = step_now_ns();
+  cpSpace *space = new_space(width, height, params);
+  if(log) replay_add_level(log, space);
+  res->build = step_now_ns() - build_start;
+  res->bodies  = count_bodies(space);
+  res->threads = params->threads > 0 ? (int)cpHastySpaceGetThreads(space) : 0;
+
+  space_get_hash(space, &res->hash_dim, &res->hash_count);
+
+  for(int i=0; i<warmup; i++) space_update(space, dt);
+  space_reset_stats(space);
+
+  int cursor = 0;
+  long iterations = 0;
+  res->iter_min = INT32_MAX;
+  res->iter_max = 0;
+  uint64_t start = step_now_ns();
+  for(int i=0; i<steps; i++) {
+    if(log) replay_apply(log, space, i, &cursor);
+
+    int it = cpSpaceGetIterations(space);
+    uint64_t t0 = step_now_ns();
+    space_update(space, dt);
+    samples[i] = step_now_ns() - t0;
+
+    iterations += it;
+    if(it < res->iter_min) res->iter_min = it;
+    if(it > res->iter_max) res->iter_max = it;
+
+    if(hashes) hashes[i] = space_last_hash(space);
+  }
+  res->total = step_now_ns() - start;
+  res->iter_avg = (double)iterations/steps;
+  space_get_stats(space, &res->stats);
+
+  space_destroy(space);
+
+  qsort(samples, steps, sizeof(uint64_t), cmp_u64);
+  res->min = samples[0];
+  res->p50 = percentile(samples, steps, 50.0);
+  res->p90 = percentile(samples, steps, 90.0);
+  res->p99 = percentile(samples, steps, 99.0);
+  res->max = samples[steps - 1];
+}
+
+// Build scenes of 1k, 10k, ... bodies up to max_bodies and time teardown.
+static void
+run_teardown(space_params params, int max_bodies) {
+  printf("%10s %12s %14s %12s\n", "bodies", "build ms", "teardown ms", "ns/body");
+  for(int n=1000; n<=max_bodies; n*=10) {
+    scene_params_for_bodies(&params.scene, n);
+
+    int width, height;
+    scene_extent(&params.scene, &width, &height);
+
+    uint64_t t0 = step_now_ns();
+    cpSpace *space = new_space(width, height, &params);
+    uint64_t t1 = step_now_ns();
+    int bodies = count_bodies(space);
+    uint64_t t2 = step_now_ns();
+    space_destroy(space);
+    uint64_t t3 = step_now_ns();
+
+    printf("%10d %12.3f %14.3f %12.1f\n", bodies, (t1 - t0)/1e6, (t3 - t2)/1e6, (double)(t3 - t2)/bodies);
+  }
+}
+
+// Grows buf until the snapshot fits. Returns its size.
+static size_t
+take_snapshot(cpSpace *space, void **buf, size_t *cap) {
+  size_t size = space_snapshot(space, *buf, *cap);
+  if(size > *cap) {
+    *cap = size*2;
+    *buf = realloc(*buf, *cap);
+    size = space_snapshot(space, *buf, *cap);
+  }
+  return size;
+}
+
+// Snapshot, step and restore every step: the rewind pattern. Then checks the
+// rewind itself: restoring one snapshot twice and stepping on from it must
+// give the same state hash after every step. Returns 1 if a restore failed
+// and 2 if the two runs diverged.
+static int
+run_snapshot(const space_params *params, int steps, int warmup, double dt) {
+  int width, height;
+  scene_extent(&params->scene, &width, &height);
+  width  = cpfmax(width, SCREEN_W);
+  height = cpfmax(height, SCREEN_H);
+
+  cpSpace *space = new_space(width, height, params);
+  for(int i=0; i<warmup; i++) space_update(space, dt);
+
+  size_t size = 0, cap = 0;
+  void *buf = NULL;
+  uint64_t snap_ns = 0, restore_ns = 0;
+  int failed = 0;
+
+  for(int i=0; i<steps; i++) {
+    uint64_t t0 = step_now_ns();
+    size = take_snapshot(space, &buf, &cap);
+    uint64_t t1 = step_now_ns();
+
+    space_update(space, dt);
+
+    uint64_t t2 = step_now_ns();
+    if(!space_restore(space, buf, size)) failed++;
+    uint64_t t3 = step_now_ns();
+
+    snap_ns    += t1 - t0;
+    restore_ns += t3 - t2;
+  }
+
+  printf("bodies            %d\n", count_bodies(space));
+  printf("snapshot size     %zu bytes\n", size);
+  printf("snapshot          %.1f us\n", snap_ns/1e3/steps);
+  printf("restore           %.1f us\n", restore_ns/1e3/steps);
+
+  // Both runs start from a restore rather than the live space, whose array
+  // and index order depend on its history.
+  uint64_t *hashes = malloc(sizeof(uint64_t)*steps);
+  int diverged = -1;
+  size = take_snapshot(space, &buf, &cap);
+  if(hashes && space_restore(space, buf, size)) {
+    for(int i=0; i<steps; i++) {
+      space_update(space, dt);
+      hashes[i] = space_hash_state(space);
+    }
+    if(space_restore(space, buf, size)) {
+      for(int i=0; i<steps && diverged < 0; i++) {
+        space_update(space, dt);
+        if(space_hash_state(space) != hashes[i]) diverged = i;
+      }
+    } else {
+      failed++;
+    }
+  } else {
+    failed++;
+  }
+
+  printf("failed restores   %d\n", failed);
+  if(diverged >= 0) {
+    printf("rewind            diverged at step %d\n", diverged);
+  } else {
+    printf("rewind            matches over %d steps\n", steps);
+  }
+
+  space_destroy(space);
+  free(hashes);
+  free(buf);
+  return failed ? 1 : diverged >= 0 ? 2 : 0;
+}
+
+// Many independent worlds stepped side by side on a pool, world i seeded
+// with seed + i.
+static void
+run_batch(const space_params *params, int worlds, int jobs, int steps, int warmup, double dt, uint64_t budget) {
+  space_params *each = malloc(sizeof(space_params)*worlds);
+  if(each == NULL) return;
+  for(int i=0; i<worlds; i++) {
+    each[i] = *params;
+    each[i].scene.seed = params->scene.seed + i;
+  }
+
+  pool *p = pool_new(jobs);
+  if(p == NULL) {
+    free(each);
+    return;
+  }
+
+  uint64_t t0 = step_now_ns();
+  batch *b = batch_new(p, each, worlds);
+  uint64_t build = step_now_ns() - t0;
+  free(each);
+  if(b == NULL) {
+    pool_free(p);
+    return;
+  }
+
+  batch_stats stats;
+  if(warmup > 0) batch_run(b, warmup, dt, 0, &stats);
+  batch_run(b, steps, dt, budget, &stats);
+
+  t0 = step_now_ns();
+  batch_free(b);
+  uint64_t teardown = step_now_ns() - t0;
+
+  double secs = stats.wall/1e9;
+  printf("worlds            %d\n", stats.worlds);
+  printf("jobs              %d\n", pool_threads(p));
+  printf("bodies            %d\n", stats.bodies);
+  printf("build             %.3f ms\n", build/1e6);
+  printf("steps             %llu (up to %d per world, warmup %d, dt %g)\n",
+    (unsigned long long)stats.steps, steps, warmup, dt);
+  if(budget) printf("budget            %.3f ms per world, %d stopped short\n", budget/1e6, stats.budgeted);
+  printf("wall              %.3f ms\n", stats.wall/1e6);
+  printf("world steps/sec   %.1f\n", stats.steps/secs);
+  printf("bodies*steps/sec  %.1f\n", stats.body_steps/secs);
+  printf("world ms  min %.3f  max %.3f  avg %.3f\n",
+    stats.min/1e6, stats.max/1e6, stats.busy/1e6/stats.worlds);
+  printf("utilization       %.1f%%\n", 100.0*stats.busy/((double)stats.wall*pool_threads(p)));
+  printf("teardown          %.3f ms\n", teardown/1e6);
+
+  pool_free(p);
+}
+
+typedef struct contact_consumer {
+  contact_ring *ring;
+  atomic_int    stop;
+  uint64_t      events;
+  double        impulse;
+} contact_consumer;
+
+static void *
+drain_contacts(void *arg) {
+  contact_consumer *c = arg;
+  contact_event events[256];
+
+  for(;;) {
+    int stop = atomic_load(&c->stop);
+    int n = contact_ring_pop(c->ring, events, 256);
+    for(int i=0; i<n; i++) c->impulse += events[i].impulse;
+    c->events += n;
+    if(n == 0) {
+      if(stop) break;
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+// Stream contacts to a consumer thread while stepping.
+static void
+run_contacts(const space_params *params, int steps, int warmup, double dt, int capacity) {
+  int width, height;
+  scene_extent(&params->scene, &width, &height);
+  width  = cpfmax(width, SCREEN_W);
+  height = cpfmax(height, SCREEN_H);
+
+  cpSpace *space = new_space(width, height, params);
+  for(int i=0; i<warmup; i++) space_update(space, dt);
+
+  contact_consumer consumer = {contact_ring_new(capacity), 0, 0, 0.0};
+  if(consumer.ring == NULL) return;
+  atomic_init(&consumer.stop, 0);
+  space_add_contact_ring(space, consumer.ring);
+
+  pthread_t thread;
+  pthread_create(&thread, NULL, drain_contacts, &consumer);
+
+  uint64_t t0 = step_now_ns();
+  for(int i=0; i<steps; i++) space_update(space, dt);
+  uint64_t total = step_now_ns() - t0;
+
+  atomic_store(&consumer.stop, 1);
+  pthread_join(thread, NULL);
+
+  printf("bodies            %d\n", count_bodies(space));
+  printf("steps             %d (warmup %d, dt %g)\n", steps, warmup, dt);
+  printf("ns/step           %.1f\n", (double)total/steps);
+  printf("contacts          %llu (%.1f/step)\n", (unsigned long long)consumer.events, (double)consumer.events/steps);
+  printf("dropped           %llu\n", (unsigned long long)contact_ring_dropped(consumer.ring));
+  printf("impulse           %.1f total\n", consumer.impulse);
+
+  space_destroy(space);
+  contact_ring_free(consumer.ring);
+}
+
+// Random sensor rays across the world between steps, cast one by one with
+// cpSpaceSegmentQueryFirst and then as one batch on the pool.
+static void
+run_queries(const space_params *params, int steps, int warmup, double dt, int queries, int jobs) {
+  int width, height;
+  scene_extent(&params->scene, &width, &height);
+  width  = cpfmax(width, SCREEN_W);
+  height = cpfmax(height, SCREEN_H);
+
+  cpSpace *space = new_space(width, height, params);
+  for(int i=0; i<warmup; i++) space_update(space, dt);
+
+  pool *p = pool_new(jobs);
+  cpVect *start = malloc(sizeof(cpVect)*queries);
+  cpVect *end   = malloc(sizeof(cpVect)*queries);
+  cpSegmentQueryInfo *serial = malloc(sizeof(cpSegmentQueryInfo)*queries);
+  cpSegmentQueryInfo *batch  = malloc(sizeof(cpSegmentQueryInfo)*queries);
+  if(p == NULL || start == NULL || end == NULL || serial == NULL || batch == NULL) steps = 0;
+
+  unsigned rng = params->scene.seed;
+  uint64_t serial_ns = 0, batch_ns = 0;
+  long hits = 0, mismatches = 0;
+
+  for(int s=0; s<steps; s++) {
+    for(int i=0; i<queries; i++) {
+      start[i] = cpv(rand_r(&rng)%width, rand_r(&rng)%height);
+      end[i]   = cpvadd(start[i], cpv(rand_r(&rng)%201 - 100, rand_r(&rng)%201 - 100));
+    }
+
+    uint64_t t0 = step_now_ns();
+    for(int i=0; i<queries; i++) cpSpaceSegmentQueryFirst(space, start[i], end[i], 0.0f, CP_SHAPE_FILTER_ALL, &serial[i]);
+    uint64_t t1 = step_now_ns();
+    space_segment_query_batch(space, p, start, end, queries, 0.0f, CP_SHAPE_FILTER_ALL, batch);
+    uint64_t t2 = step_now_ns();
+
+    serial_ns += t1 - t0;
+    batch_ns  += t2 - t1;
+    for(int i=0; i<queries; i++) {
+      hits += batch[i].shape != NULL;
+      mismatches += batch[i].shape != serial[i].shape;
+    }
+
+    space_update(space, dt);
+  }
+
+  if(steps > 0) {
+    printf("bodies            %d\n", count_bodies(space));
+    printf("queries           %d per step, %d steps\n", queries, steps);
+    printf("serial            %.1f us/step\n", serial_ns/1e3/steps);
+    printf("batch             %.1f us/step on %d threads (%.2fx)\n",
+      batch_ns/1e3/steps, pool_threads(p), (double)serial_ns/batch_ns);
+    printf("hits              %.1f%%\n", 100.0*hits/((double)queries*steps));
+    printf("mismatches        %ld\n", mismatches);
+  }
+
+  free(start);
+  free(end);
+  free(serial);
+  free(batch);
+  pool_free(p);
+  space_destroy(space);
+}
+
+// Compile a level image from scratch, then load it again from the cache it
+// wrote.
+static void
+run_level(const char *image) {
+  char cache[1024];
+  snprintf(cache, sizeof(cache), "%s.lvl", image);
+  remove(cache);
+
+  uint64_t t0 = step_now_ns();
+  level *compiled = level_load(image, cache, 0.5f, 1.0f);
+  uint64_t t1 = step_now_ns();
+  level *cached = level_load(image, cache, 0.5f, 1.0f);
+  uint64_t t2 = step_now_ns();
+
+  if(compiled == NULL || cached == NULL) {
+    fprintf(stderr, "can't load level %s\n", image);
+  } else {
+    printf("image             %dx%d\n", compiled->width, compiled->height);
+    printf("chains            %d (%d vertexes)\n", compiled->num_chains, compiled->num_verts);
+    printf("compile           %.3f ms\n", (t1 - t0)/1e6);
+    printf("cached load       %.3f ms\n", (t2 - t1)/1e6);
+  }
+  level_free(compiled);
+  level_free(cached);
+}
+
+// Random star outlines: concave, simple and different from each other.
+static int
+star_outline(unsigned *rng, cpVect *verts) {
+  int count = 8 + rand_r(rng)%17;
+  for(int i=0; i<count; i++) {
+    cpFloat r = (i%2 ? 6.0f : 14.0f) + rand_r(rng)%400/100.0f;
+    verts[i] = cpvmult(cpvforangle(2.0f*CP_PI*i/count), r);
+  }
+  return count;
+}
+
+// Decompose outlines into an empty cache file, then again from the file,
+// then look them up as if spawning copies.
+static void
+run_decomp(const char *path, int outlines, unsigned seed) {
+  cpVect (*verts)[24] = malloc(sizeof(*verts)*outlines);
+  int *counts = malloc(sizeof(int)*outlines);
+  if(verts == NULL || counts == NULL) return;
+
+  unsigned rng = seed;
+  for(int i=0; i<outlines; i++) counts[i] = star_outline(&rng, verts[i]);
+
+  remove(path);
+  decomp_cache *cold = decomp_cache_new(path);
+  uint64_t t0 = step_now_ns();
+  int hulls = 0;
+  for(int i=0; i<outlines; i++) {
+    const decomp *d = decomp_get(cold, verts[i], counts[i], 0.5f);
+    if(d) hulls += d->num_hulls;
+  }
+  uint64_t t1 = step_now_ns();
+  if(!decomp_cache_save(cold)) fprintf(stderr, "can't write %s\n", path);
+  decomp_cache_free(cold);
+
+  uint64_t t2 = step_now_ns();
+  decomp_cache *warm = decomp_cache_new(path);
+  for(int i=0; i<outlines; i++) decomp_get(warm, verts[i], counts[i], 0.5f);
+  uint64_t t3 = step_now_ns();
+
+  int spawns = 10*outlines;
+  for(int i=0; i<spawns; i++) decomp_get(warm, verts[i%outlines], counts[i%outlines], 0.5f);
+  uint64_t t4 = step_now_ns();
+  decomp_cache_free(warm);
+
+  printf("outlines          %d (%d hulls)\n", outlines, hulls);
+  printf("decompose         %.3f ms\n", (t1 - t0)/1e6);
+  printf("load from cache   %.3f ms\n", (t3 - t2)/1e6);
+  printf("lookup            %.1f ns per spawn\n", (double)(t4 - t3)/spawns);
+
+  free(verts);
+  free(counts);
+}
+
+static void
+print_phase(const char *name, uint64_t ns, const space_stats *stats) {
+  printf("  %-12s %10.1f us/step %6.1f%%\n", name, ns/1e3/stats->steps, stats->total ? 100.0*ns/stats->total : 0.0);
+}
+
+static void
+print_stats(const space_stats *stats) {
+  if(stats->steps == 0) return;
+
+  printf("phases (avg over %llu steps)\n", (unsigned long long)stats->steps);
+  print_phase("broadphase",  stats->broadphase,  stats);
+  print_phase("narrowphase", stats->narrowphase, stats);
+  print_phase("sleep",       stats->sleep,       stats);
+  print_phase("prestep",     stats->prestep,     stats);
+  print_phase("solver",      stats->solver,      stats);
+  print_phase("integrate",   stats->integrate,   stats);
+  print_phase("callbacks",   stats->callbacks,   stats);
+  print_phase("total",       stats->total,       stats);
+  printf("  pairs/step %.1f  arbiters/step %.1f\n",
+    (double)stats->pairs/stats->steps, (double)stats->arbiters/stats->steps);
+}
+
+// One hex hash per line, step by step after the warmup.
+static int
+write_hashes(const char *path, const uint64_t *hashes, int steps) {
+  FILE *f = fopen(path, "w");
+  if(f == NULL) return 0;
+  for(int i=0; i<steps; i++) fprintf(f, "%016llx\n", (unsigned long long)hashes[i]);
+  return fclose(f) == 0;
+}
+
+// Returns the first step whose hash differs from the reference file, -1 if
+// all match, or -2 if the file can't be read.
+static int
+compare_hashes(const char *path, const uint64_t *hashes, int steps) {
+  FILE *f = fopen(path, "r");
+  if(f == NULL) return -2;
+
+  int diverged = -1;
+  for(int i=0; i<steps && diverged < 0; i++) {
+    unsigned long long ref;
+    if(fscanf(f, "%llx", &ref) != 1 || ref != hashes[i]) diverged = i;
+  }
+  fclose(f);
+  return diverged;
+}
+
+// The scene as a replay log of steps steps without input, to check a world
+// across configurations without recording a session in chipmunk_sdl.
+static int
+write_replay(const space_params *params, int steps, double dt, const char *path) {
+  int width, height;
+  scene_extent(&params->scene, &width, &height);
+
+  replay_log *log = replay_new(cpfmax(width, SCREEN_W), cpfmax(height, SCREEN_H), dt, params);
+  if(log == NULL) return 1;
+  log->steps = steps;
+
+  int ok = replay_save(log, path);
+  if(!ok) fprintf(stderr, "can't write replay log %s\n", path);
+  replay_free(log);
+  return !ok;
+}
+
+static const char *index_names[] = {"tree", "hash", "sweep"};
+
+// -i tree | sweep | hash[:dim[:count]]
+static int
+parse_index(const char *arg, space_params *params) {
+  for(int i=0; i<3; i++) {
+    size_t len = strlen(index_names[i]);
+    if(strncmp(arg, index_names[i], len) == 0 && (arg[len] == '\0' || arg[len] == ':')) {
+      params->index = (space_index)i;
+      if(arg[len] == ':') {
+        if(params->index != SPACE_INDEX_HASH) return 0;
+        sscanf(arg + len + 1, "%lf:%d", &params->hash_dim, &params->hash_count);
+      }
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void
+usage(const char *prog) {
+  fprintf(stderr,
+    "usage: %s [-n steps] [-w warmup] [-d dt] [-t threads] [-s] [-i index] [-a] [-T max] [-X] [-P log] [-R log]\n"
+    "          [-H out] [-C ref] [-f] [-B worlds] [-j jobs] [-m ms] [-E cap] [-Q queries] [-A us] [-L image] [-D cache]\n"
+    "          [-b bodies] [-r rows] [-g COLSxHEIGHT] [-c circles] [-p polys] [-k concave] [-K cache] [-S seed]\n"
+    "  -n steps    measured steps (default 2000)\n"
+    "  -w warmup   unmeasured steps before timing (default 100)\n"
+    "  -d dt       fixed timestep in seconds (default 0.02)\n"
+    "  -b bodies   mixed scene of about this many bodies (overrides the default scene)\n"
+    "  -r rows     pyramid height (default 12)\n"
+    "  -g CxH      grid of C stacks of H boxes\n"
+    "  -c circles  random circles dropped from above\n"
+    "  -p polys    random polygons dropped from above\n"
+    "  -k concave  concave compound bodies dropped from above\n"
+    "  -K cache    file caching their decompositions across runs\n"
+    "  -S seed     random seed for the scene (default 1)\n"
+    "  -t threads  step a cpHastySpace on this many threads (default 0, plain cpSpace)\n"
+    "  -s          scaling run: repeat the benchmark for 1..threads threads\n"
+    "  -i index    tree (default), sweep or hash[:dim[:count]], hash params\n"
+    "              are tuned from the scene when left out\n"
+    "  -a          allocate bodies and shapes from contiguous arenas\n"
+    "  -T max      teardown run: time space_destroy for 1k, 10k, ... max bodies\n"
+    "  -X          snapshot run: time space_snapshot and space_restore every step, then\n"
+    "              check that stepping on from a restore is repeatable (exit 2 if not)\n"
+    "  -P log      replay a session recorded with chipmunk_sdl -R, its world, dt\n"
+    "              and length replace the scene, -d, -n and -w options\n"
+    "  -R log      write the scene as an input-free replay log of -n steps for -P\n"
+    "  -H out      write the world state hash of every measured step to out\n"
+    "  -C ref      compare state hashes against a file written by -H and report\n"
+    "              the first diverging step\n"
+    "  -f          profile: break step time down by phase\n"
+    "  -A us       adapt solver iterations to keep steps under this budget\n"
+    "  -B worlds   batch run: step this many independent worlds in parallel,\n"
+    "              world i seeded with seed + i\n"
+    "  -j jobs     batch and query run threads (default: online CPUs)\n"
+    "  -m ms       batch run: stop a world after this much stepping time\n"
+    "  -E cap      contact run: stream new contacts to a consumer thread through\n"
+    "              a ring of cap events\n"
+    "  -D cache    decomposition run: decompose -k random concave outlines (default\n"
+    "              1000) through a cache file, then reload them from it\n"
+    "  -L image    level run: compile a PGM/PPM level, then load it from its cache\n"
+    "  -Q queries  query run: cast this many random rays between steps, one by one\n"
+    "              and batched on -j threads\n",
+    prog);
+}
+
+int main(int argc, char **argv) {
+
+  int    steps   = 2000;
+  int    warmup  = 100;
+  double dt      = 0.02;
+  int    scaling = 0;
+  int    teardown = 0;
+  int    snapshot = 0;
+  int    worlds   = 0;
+  int    jobs     = 0;
+  double budget   = 0.0;
+  int    contacts = 0;
+  int    queries  = 0;
+
+  const char *replay_path = NULL;
+  const char *record_path = NULL;
+  const char *hash_out    = NULL;
+  const char *hash_ref    = NULL;
+  const char *level_path  = NULL;
+  const char *decomp_path = NULL;
+  replay_log *log = NULL;
+
+  space_params params;
+  space_params_default(&params);
+
+  int opt;
+  while((opt = getopt(argc, argv, "n:w:d:t:si:aT:XP:R:H:C:fB:j:m:E:Q:A:L:D:b:r:g:c:p:k:K:S:h")) != -1) {
+    switch(opt) {
+      case 'n': steps                     = atoi(optarg); break;
+      case 'w': warmup                    = atoi(optarg); break;
+      case 'd': dt                        = atof(optarg); break;
+      case 't': params.threads            = atoi(optarg); break;
+      case 's': scaling                   = 1;            break;
+      case 'i':
+        if(!parse_index(optarg, &params)) {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'a': params.arena              = 1;            break;
+      case 'T': teardown                  = atoi(optarg); break;
+      case 'X': snapshot                  = 1;            break;
+      case 'P': replay_path               = optarg;       break;
+      case 'R': record_path               = optarg;       break;
+      case 'f': params.profile            = 1;            break;
+      case 'A': params.step_budget        = atof(optarg)*1e-6; break;
+      case 'H': hash_out                  = optarg;       break;
+      case 'C': hash_ref                  = optarg;       break;
+      case 'B': worlds                    = atoi(optarg); break;
+      case 'j': jobs                      = atoi(optarg); break;
+      case 'm': budget                    = atof(optarg); break;
+      case 'E': contacts                  = atoi(optarg); break;
+      case 'Q': queries                   = atoi(optarg); break;
+      case 'L': level_path                = optarg;       break;
+      case 'D': decomp_path               = optarg;       break;
+      case 'b': scene_params_for_bodies(&params.scene, atoi(optarg)); break;
+      case 'r': params.scene.pyramid_rows = atoi(optarg); break;
+      case 'g':
+        if(sscanf(optarg, "%dx%d", &params.scene.stack_cols, &params.scene.stack_height) != 2) {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'c': params.scene.rain_circles = atoi(optarg); break;
+      case 'p': params.scene.rain_polys   = atoi(optarg); break;
+      case 'k': params.scene.rain_concave = atoi(optarg); break;
+      case 'K': params.scene.decomp_cache = optarg;       break;
+      case 'S': params.scene.seed         = strtoul(optarg, NULL, 0); break;
+      default : usage(argv[0]); return opt == 'h' ? 0 : 1;
+    }
+  }
+  if(steps <= 0 || warmup < 0 || dt <= 0.0 || params.threads < 0 || scene_body_count(&params.scene) <= 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if(record_path) return write_replay(&params, steps, dt, record_path);
+
+  if(replay_path) {
+    log = replay_load(replay_path);
+    if(log == NULL) {
+      fprintf(stderr, "can't read replay log %s\n", replay_path);
+      return 1;
+    }
+    // Only the world and the session length come from the log. How it is
+    // stepped (threads, index, arena, profiling, budget) stays the command
+    // line's, so one session can be checked across configurations.
+    const char *cache = params.scene.decomp_cache;
+    params.scene = log->params.scene;
+    params.scene.decomp_cache = cache;
+    steps   = log->steps;
+    warmup  = 0;
+    dt      = log->dt;
+    scaling = 0;
+    if(steps <= 0) {
+      fprintf(stderr, "replay log %s is empty\n", replay_path);
+      return 1;
+    }
+  }
+
+  if(decomp_path) {
+    run_decomp(decomp_path, params.scene.rain_concave > 0 ? params.scene.rain_concave : 1000, params.scene.seed);
+    return 0;
+  }
+
+  if(level_path) {
+    run_level(level_path);
+    return 0;
+  }
+
+  if(teardown > 0) {
+    run_teardown(params, teardown);
+    return 0;
+  }
+
+  if(snapshot) {
+    return run_snapshot(&params, steps, warmup, dt);
+  }
+
+  if(contacts > 0) {
+    run_contacts(&params, steps, warmup, dt, contacts);
+    return 0;
+  }
+
+  if(queries > 0) {
+    run_queries(&params, steps, warmup, dt, queries, jobs);
+    return 0;
+  }
+
+  if(worlds > 0) {
+    run_batch(&params, worlds, jobs, steps, warmup, dt, (uint64_t)(budget*1e6));
+    return 0;
+  }
+
+  uint64_t *samples = malloc(sizeof(uint64_t)*steps);
+  if(samples == NULL) return 1;
+
+  uint64_t *hashes = NULL;
+  if(hash_out || hash_ref) {
+    params.hash = 1;
+    hashes = malloc(sizeof(uint64_t)*steps);
+    if(hashes == NULL) return 1;
+  }
+
+  bench_result res;
+
+  if(scaling) {
+    int max_threads = params.threads > 0 ? params.threads : 1;
+    double base = 0.0;
+
+    printf("%8s %8s %12s %12s %12s %8s\n", "threads", "actual", "steps/sec", "p50 ns", "p99 ns", "speedup");
+    for(int t=1; t<=max_threads; t++) {
+      params.threads = t;
+      run(&params, log, steps, warmup, dt, samples, hashes, &res);
+
+      double rate = steps/(res.total/1e9);
+      if(t == 1) base = rate;
+      printf("%8d %8d %12.1f %12llu %12llu %8.2f\n", t, res.threads, rate,
+        (unsigned long long)res.p50, (unsigned long long)res.p99, rate/base);
+    }
+    printf("bodies %d, steps %d (warmup %d, dt %g), index %s\n", res.bodies, steps, warmup, dt, index_names[params.index]);
+  } else {
+    run(&params, log, steps, warmup, dt, samples, hashes, &res);
+
+    double secs = res.total/1e9;
+    printf("bodies            %d\n", res.bodies);
+    printf("threads           %d\n", res.threads);
+    if(params.index == SPACE_INDEX_HASH) {
+      printf("index             hash (dim %.1f, count %d)\n", res.hash_dim, res.hash_count);
+    } else {
+      printf("index             %s\n", index_names[params.index]);
+    }
+    printf("allocation        %s\n", params.arena ? "arena" : "heap");
+    printf("build             %.3f ms\n", res.build/1e6);
+    printf("steps             %d (warmup %d, dt %g)\n", steps, warmup, dt);
+    printf("total             %.3f ms\n", res.total/1e6);
+    printf("steps/sec         %.1f\n", steps/secs);
+    printf("bodies*steps/sec  %.1f\n", (double)res.bodies*steps/secs);
+    printf("ns/step  min %llu  p50 %llu  p90 %llu  p99 %llu  max %llu\n",
+      (unsigned long long)res.min, (unsigned long long)res.p50,
+      (unsigned long long)res.p90, (unsigned long long)res.p99,
+      (unsigned long long)res.max);
+    if(params.step_budget > 0.0f) {
+      printf("iterations        min %d  avg %.1f  max %d (budget %.0f us)\n",
+        res.iter_min, res.iter_avg, res.iter_max, params.step_budget*1e6);
+    }
+    if(params.profile) print_stats(&res.stats);
+  }
+
+  int status = 0;
+  if(hash_out && !write_hashes(hash_out, hashes, steps)) {
+    fprintf(stderr, "can't write hashes to %s\n", hash_out);
+    status = 1;
+  }
+  if(hash_ref) {
+    int diverged = compare_hashes(hash_ref, hashes, steps);
+    if(diverged == -2) {
+      fprintf(stderr, "can't read hashes from %s\n", hash_ref);
+      status = 1;
+    } else if(diverged >= 0) {
+      printf("state diverged    at step %d (after %d warmup steps)\n", diverged, warmup);
+      status = 2;
+    } else {
+      printf("state matches     %s\n", hash_ref);
+    }
+  }
+
+  free(samples);
+  free(hashes);
+  replay_free(log);
+  return status;
+}
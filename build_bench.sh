@@ -0,0 +1,6 @@
+#!/bin/bash
+clang bench.c space.c scene.c decomp.c arena.c snapshot.c replay.c step.c level.c contact.c pool.c batch.c query.c \
+-Wall -O2 -g \
+-o chipmunk_bench \
+-lchipmunk \
+-lpthread -lm
@@ -0,0 +1,8 @@
+#!/bin/bash
+clang headless.c space.c scene.c decomp.c arena.c replay.c level.c step.c contact.c pool.c raster.c \
+-I/usr/include/SDL \
+-Wall -O2 -g \
+-o chipmunk_headless \
+-lchipmunk \
+-lpthread -lm \
+-lSDL
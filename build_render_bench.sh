@@ -0,0 +1,8 @@
+#!/bin/bash
+clang render_bench.c space.c scene.c decomp.c arena.c replay.c level.c step.c contact.c raster.c \
+-I/usr/include/SDL \
+-Wall -O2 -g \
+-o chipmunk_render_bench \
+-lchipmunk \
+-lpthread -lm \
+-lSDL_gfx -lSDL
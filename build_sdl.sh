@@ -1,9 +1,9 @@
 #!/bin/bash
-clang chipmunk_sdl.c space.c \
+clang chipmunk_sdl.c space.c scene.c decomp.c arena.c snapshot.c replay.c step.c level.c contact.c query.c pool.c raster.c \
 -I/usr/include/SDL \
 -Wall -g \
 -o chipmunk_sdl \
 -lchipmunk \
 -lpthread -lm \
--lSDL_gfx -lSDLmain -lSDL \
+-lSDLmain -lSDL \
 && ./chipmunk_sdl
@@ -0,0 +1,49 @@
+#!/bin/bash
+# Determinism checks of chipmunk_bench. Rewinds: a snapshot restored twice
+# must step on to the same state hashes, over a settled (partly sleeping)
+# pyramid and a mixed scene on each spatial index. Replays: a log replayed
+# on the plain cpSpace must match its own reference, and a replay with -t 4
+# must really step a cpHastySpace and be compared against it.
+set -e
+
+./build_bench.sh
+
+steps=${1:-300}
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+
+status=0
+check() {
+  local report
+  if report=$(./chipmunk_bench "$@"); then
+    echo "ok:     $*"
+  else
+    echo "FAILED: $*"
+    echo "$report" | grep -E "failed restores|rewind|state"
+    status=1
+  fi
+}
+
+check -X -n "$steps" -w 600
+check -X -n "$steps" -b 2000 -i tree
+check -X -n "$steps" -b 2000 -i sweep
+check -X -n "$steps" -b 2000 -i hash
+
+./chipmunk_bench -R "$out/scene.log" -n "$steps" -b 2000 -k 50
+./chipmunk_bench -P "$out/scene.log" -t 0 -H "$out/ref.hash" > /dev/null
+check -P "$out/scene.log" -t 0 -C "$out/ref.hash"
+
+# Whether 4 threads reproduce the plain space is reported, not required;
+# the command line's -t must win over the log's and the comparison must run.
+set +e
+./chipmunk_bench -P "$out/scene.log" -t 4 -C "$out/ref.hash" > "$out/threads.txt"
+result=$?
+set -e
+if [ $result -ne 1 ] && grep -qE "^threads +[1-9]" "$out/threads.txt"; then
+  echo "ok:     -P scene.log -t 4 -C ref.hash: $(grep -E "^state" "$out/threads.txt")"
+else
+  echo "FAILED: -P scene.log -t 4 -C ref.hash"
+  cat "$out/threads.txt"
+  status=1
+fi
+exit $status
@@ -0,0 +1,69 @@
+#!/bin/bash
+# Two checks at every screen depth:
+#
+#   golden  the full redraw after GOLDEN_FRAMES frames must match the
+#           committed golden/headless_<bits>.ppm within a small tolerance
+#   dirty   the dirty rectangle frame must match the full redraw exactly
+#
+# Diff images of failing checks are left in the working directory. -u writes
+# the golden images from this build instead; only do that on a build whose
+# output is known to be right, and commit them.
+#
+#   ./check_render.sh [-u] [frames]
+set -e
+
+update=0
+if [ "$1" = "-u" ]; then
+  update=1
+  shift
+fi
+
+./build_headless.sh
+
+frames=${1:-300}
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+
+# The goldens are rendered at a fixed frame count whatever frames is. The
+# tolerance absorbs rounding differences between compilers; anything drawn
+# in the wrong place is far more pixels than that.
+GOLDEN_FRAMES=300
+GOLDEN_TOLERANCE=2
+GOLDEN_PIXELS=64
+
+if [ $update = 1 ]; then
+  mkdir -p golden
+  for bits in 16 24 32; do
+    ./chipmunk_headless -n $GOLDEN_FRAMES -b "$bits" -F -o "golden/headless_$bits.ppm" > /dev/null
+    echo "$bits bit: wrote golden/headless_$bits.ppm"
+  done
+  exit 0
+fi
+
+status=0
+for bits in 16 24 32; do
+  golden="golden/headless_$bits.ppm"
+  if [ ! -f "$golden" ]; then
+    echo "$bits bit: no $golden, write it with ./check_render.sh -u on a known good build"
+    status=1
+  elif ./chipmunk_headless -n $GOLDEN_FRAMES -b "$bits" -F -g "$golden" \
+      -t $GOLDEN_TOLERANCE -m $GOLDEN_PIXELS -D "render_golden_$bits.ppm" > "$out/golden.txt"; then
+    rm -f "render_golden_$bits.ppm"
+    echo "$bits bit: matches $golden"
+  else
+    echo "$bits bit: differs from $golden, see render_golden_$bits.ppm"
+    grep -E "mismatched|max difference" "$out/golden.txt" || true
+    status=1
+  fi
+
+  ./chipmunk_headless -n "$frames" -b "$bits" -F -o "$out/full.ppm" > /dev/null
+  if ./chipmunk_headless -n "$frames" -b "$bits" -g "$out/full.ppm" -t 0 -D "render_diff_$bits.ppm" > "$out/dirty.txt"; then
+    rm -f "render_diff_$bits.ppm"
+    echo "$bits bit: dirty frame matches full redraw"
+  else
+    echo "$bits bit: dirty frame differs from full redraw, see render_diff_$bits.ppm"
+    grep -E "mismatched|max difference" "$out/dirty.txt" || true
+    status=1
+  fi
+done
+exit $status
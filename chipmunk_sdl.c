@@ -1,37 +1,93 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
 
 #include <SDL/SDL.h>
-#include <SDL/SDL_gfxPrimitives.h>
 
 #include <chipmunk/chipmunk_private.h>
 #include <chipmunk/chipmunk.h>
 
 #include "space.h"
+#include "replay.h"
+#include "level.h"
+#include "raster.h"
+#include "pool.h"
 
 #define SCREEN_W  640
 #define SCREEN_H  480
+#define SCREEN_BG 0x000080
 
-static void DrawImpl(cpSpace *space);
+// Simulation runs at a fixed rate independent of the display. A frame never
+// runs more than MAX_SUBSTEPS steps; time beyond that is dropped so a slow
+// frame can't snowball into ever longer ones.
+#define STEP_DT       0.02
+#define MAX_SUBSTEPS  5
 
-static cpSpaceDebugColor
-ColorForShape(cpShape *shape, cpDataPointer data);
-
-static inline cpSpaceDebugColor RGBAColor(float r, float g, float b, float a){
-  cpSpaceDebugColor color = {r, g, b, a};
-  return color;
-}
-
-static inline cpSpaceDebugColor LAColor(float l, float a){
-  cpSpaceDebugColor color = {l, l, l, a};
-  return color;
-}
+static int  DrawDirty(cpSpace *space);
+static void InvalidateScreen(void);
+static void RenderStart(int threads);
+static void RenderSubmit(void);
+static void RenderStop(void);
 
 static SDL_Surface *screen = NULL;
 cpSpace *space = NULL;
 
-int main(void){
+int main(int argc, char **argv){
+
+  // -R file records the session's input for chipmunk_bench -P.
+  // -L image adds static level geometry compiled from a PGM/PPM bitmap,
+  // cached next to it in image.lvl.
+  // -j threads rasterizes frames on that many threads.
+  const char *record_path    = NULL;
+  const char *level_path     = NULL;
+  int         render_threads = 0;
+  replay_log *record = NULL;
+
+  int opt;
+  while((opt = getopt(argc, argv, "R:L:j:")) != -1) {
+    if(opt == 'R') {
+      record_path = optarg;
+    } else if(opt == 'L') {
+      level_path = optarg;
+    } else if(opt == 'j') {
+      render_threads = atoi(optarg);
+    } else {
+      fprintf(stderr, "usage: %s [-R record.log] [-L level.pgm] [-j threads]\n", argv[0]);
+      return 1;
+    }
+  }
   
   space = space_init(SCREEN_W, SCREEN_H);
+  if(space == NULL) {
+    fprintf(stderr, "can't build the world\n");
+    return 1;
+  }
+
+  if(record_path) {
+    record = replay_new(SCREEN_W, SCREEN_H, STEP_DT, NULL);
+    space_record(space, record);
+  }
+
+  if(level_path) {
+    char cache[1024];
+    snprintf(cache, sizeof(cache), "%s.lvl", level_path);
+
+    level *lvl = level_load(level_path, cache, 0.5f, 1.0f);
+    if(lvl == NULL) {
+      fprintf(stderr, "can't load level %s\n", level_path);
+      return 1;
+    }
+    level_add(lvl, space, 1.0f);
+
+    // The recording carries the level along, so replays rebuild it exactly.
+    if(record && !replay_set_level(record, lvl, 1.0f)) {
+      fprintf(stderr, "can't record level %s\n", level_path);
+      return 1;
+    }
+    level_free(lvl);
+  }
 
   SDL_Event evt; 
 
@@ -42,11 +98,15 @@ int main(void){
   screen = SDL_SetVideoMode(
     SCREEN_W, 
     SCREEN_H, 
-    24, SDL_HWSURFACE | SDL_DOUBLEBUF);
+    24, SDL_SWSURFACE);
 
   if (screen == NULL) {
     return -1;
   }
+  RenderStart(render_threads);
+
+  Uint32 last_ticks  = SDL_GetTicks();
+  double accumulator = 0.0;
 
   while(1) {
     while(SDL_PollEvent(&evt)) {
@@ -57,24 +117,48 @@ int main(void){
         goto finish;
       }
 
+      if (evt.type == SDL_VIDEOEXPOSE    ) InvalidateScreen();
       if (evt.type == SDL_MOUSEMOTION    ) space_mouse_move(space, evt.motion.x, evt.motion.y);
       if (evt.type == SDL_MOUSEBUTTONDOWN) space_mouse_down(space);
       if (evt.type == SDL_MOUSEBUTTONUP  ) space_mouse_up  (space);
     }
 
 
-    SDL_LockSurface(screen);
-    SDL_FillRect(screen, NULL, 0x000080); 
-    space_update(space, 0.02);
+    Uint32 ticks = SDL_GetTicks();
+    accumulator += (ticks - last_ticks)/1000.0;
+    last_ticks = ticks;
 
-    DrawImpl(space);
+    int substeps = 0;
+    while(accumulator >= STEP_DT && substeps < MAX_SUBSTEPS) {
+      space_update(space, STEP_DT);
+      accumulator -= STEP_DT;
+      substeps++;
+    }
+    if(accumulator >= STEP_DT) {
+      accumulator -= STEP_DT*(int)(accumulator/STEP_DT);
+    }
+
+    // Only changed parts of the single buffered screen are redrawn and
+    // copied out. The frame is recorded here and drawn on the render thread
+    // while the next steps run. With nothing to redraw there is nothing to
+    // do until the next step is due.
+    space_interpolate(space, accumulator/STEP_DT);
+    int count = DrawDirty(space);
+    space_interpolate_end(space);
 
-    SDL_FreeSurface(screen);
-    SDL_Flip(screen);
+    RenderSubmit();
+    if(count == 0) SDL_Delay(1);
   }
   
 finish:
+
+  if(record) {
+    record->steps = space_step_index(space);
+    if(!replay_save(record, record_path)) fprintf(stderr, "failed to write %s\n", record_path);
+    replay_free(record);
+  }
   
+  RenderStop();
   space_destroy(space);  
   SDL_FreeSurface(screen);
   SDL_Quit();
@@ -0,0 +1,76 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "contact.h"
+
+// head and tail count events ever pushed and popped; the slot of an event is
+// its count masked by the capacity. Each side owns one counter and only reads
+// the other, so no locks are needed. They sit on separate cache lines so the
+// producer and consumer don't bounce one line between them.
+struct contact_ring {
+  _Alignas(64) atomic_uint_fast64_t head;
+  _Alignas(64) atomic_uint_fast64_t tail;
+  _Alignas(64) atomic_uint_fast64_t dropped;
+  uint64_t       mask;
+  contact_event *events;
+};
+
+contact_ring *
+contact_ring_new(int capacity) {
+  uint64_t size = 16;
+  while(size < (uint64_t)capacity) size *= 2;
+
+  contact_ring *r = aligned_alloc(64, sizeof(contact_ring));
+  if(r == NULL) return NULL;
+
+  r->events = malloc(sizeof(contact_event)*size);
+  if(r->events == NULL) {
+    free(r);
+    return NULL;
+  }
+  r->mask = size - 1;
+  atomic_init(&r->head, 0);
+  atomic_init(&r->tail, 0);
+  atomic_init(&r->dropped, 0);
+  return r;
+}
+
+void
+contact_ring_free(contact_ring *r) {
+  if(r == NULL) return;
+  free(r->events);
+  free(r);
+}
+
+int
+contact_ring_push(contact_ring *r, const contact_event *event) {
+  uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  uint64_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+  if(head - tail > r->mask) {
+    atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+    return 0;
+  }
+
+  r->events[head & r->mask] = *event;
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+  return 1;
+}
+
+int
+contact_ring_pop(contact_ring *r, contact_event *out, int max) {
+  uint64_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  uint64_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+  int count = 0;
+  while(count < max && tail + count != head) {
+    out[count] = r->events[(tail + count) & r->mask];
+    count++;
+  }
+  atomic_store_explicit(&r->tail, tail + count, memory_order_release);
+  return count;
+}
+
+uint64_t
+contact_ring_dropped(const contact_ring *r) {
+  return atomic_load_explicit(&((contact_ring *)r)->dropped, memory_order_relaxed);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+
+// Fixed-size record of a new contact, written from the step thread.
+typedef struct contact_event {
+  uint32_t step;      // space_step_index of the step that found the contact
+  uint32_t a, b;      // shape hashids
+  float    px, py;    // first contact point, on shape a
+  float    nx, ny;    // contact normal, from a to b
+  float    impulse;   // magnitude of the total impulse applied this step
+} contact_event;
+
+// Single-producer single-consumer ring of contact events. The step thread
+// only ever appends; one consumer thread drains it. Every consumer that wants
+// the stream gets its own ring. A full ring drops new events and counts them
+// instead of stalling the step.
+typedef struct contact_ring contact_ring;
+
+// capacity is rounded up to a power of two.
+contact_ring * contact_ring_new    (int capacity);
+void           contact_ring_free   (contact_ring *r);
+
+// Producer side.
+int            contact_ring_push   (contact_ring *r, const contact_event *event);
+
+// Consumer side: copies up to max events into out and returns how many.
+int            contact_ring_pop    (contact_ring *r, contact_event *out, int max);
+
+// Events lost to a full ring so far. Safe to read from any thread.
+uint64_t       contact_ring_dropped(const contact_ring *r);
@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chipmunk/chipmunk.h>
+#include <chipmunk/cpPolyline.h>
+
+#include "decomp.h"
+
+#define DECOMP_MAGIC   0x63636564u // "decc"
+#define DECOMP_VERSION 1
+
+struct decomp_cache {
+  char    *path;
+  decomp **entries;
+  int      num, max;
+  int      dirty;
+};
+
+typedef struct decomp_record {
+  uint64_t key;
+  cpFloat  area, moment;
+  int32_t  num_hulls, num_verts;
+} decomp_record;
+
+// FNV-1a over the outline as given plus the tolerance. The same shape given
+// from another start vertex hashes differently and gets its own entry.
+static uint64_t
+outline_key(const cpVect *outline, int count, cpFloat tolerance) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  const unsigned char *p = (const unsigned char *)outline;
+  for(size_t i=0; i<sizeof(cpVect)*count; i++) {
+    h ^= p[i];
+    h *= 0x100000001b3ull;
+  }
+  p = (const unsigned char *)&tolerance;
+  for(size_t i=0; i<sizeof(tolerance); i++) {
+    h ^= p[i];
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+static decomp *
+decomp_alloc(int num_hulls, int num_verts) {
+  decomp *d = calloc(1, sizeof(decomp));
+  if(d == NULL) return NULL;
+
+  d->num_hulls   = num_hulls;
+  d->num_verts   = num_verts;
+  d->hull_counts = malloc(sizeof(int)*(num_hulls ? num_hulls : 1));
+  d->verts       = malloc(sizeof(cpVect)*(num_verts ? num_verts : 1));
+  if(d->hull_counts == NULL || d->verts == NULL) {
+    free(d->hull_counts);
+    free(d->verts);
+    free(d);
+    return NULL;
+  }
+  return d;
+}
+
+static void
+decomp_free(decomp *d) {
+  if(d == NULL) return;
+  free(d->hull_counts);
+  free(d->verts);
+  free(d);
+}
+
+static int
+cache_push(decomp_cache *cache, decomp *d) {
+  if(cache->num == cache->max) {
+    int max = cache->max ? cache->max*2 : 16;
+    decomp **entries = realloc(cache->entries, sizeof(decomp *)*max);
+    if(entries == NULL) return 0;
+    cache->entries = entries;
+    cache->max = max;
+  }
+  cache->entries[cache->num++] = d;
+  return 1;
+}
+
+// FILE
+
+// Every hull a polygon and the hulls adding up to num_verts, or scene.c
+// would walk past the vertexes.
+static int
+decomp_valid(const decomp *d) {
+  long total = 0;
+  for(int i=0; i<d->num_hulls; i++) {
+    if(d->hull_counts[i] < 3) return 0;
+    total += d->hull_counts[i];
+  }
+  return total == d->num_verts;
+}
+
+static void
+cache_load(decomp_cache *cache, FILE *f) {
+  uint32_t header[3];
+  if(fread(header, sizeof(header), 1, f) != 1 || header[0] != DECOMP_MAGIC || header[1] != DECOMP_VERSION) return;
+
+  for(uint32_t i=0; i<header[2]; i++) {
+    decomp_record rec;
+    if(fread(&rec, sizeof(rec), 1, f) != 1 || rec.num_hulls < 0 || rec.num_verts < 0) return;
+
+    decomp *d = decomp_alloc(rec.num_hulls, rec.num_verts);
+    if(d == NULL) return;
+    d->key    = rec.key;
+    d->area   = rec.area;
+    d->moment = rec.moment;
+
+    if(
+      fread(d->hull_counts, sizeof(int), d->num_hulls, f) != (size_t)d->num_hulls ||
+      fread(d->verts, sizeof(cpVect), d->num_verts, f) != (size_t)d->num_verts
+    ) {
+      decomp_free(d);
+      return;
+    }
+
+    // A bad entry is dropped and decomposed again when asked for; the file
+    // is rewritten without it on the next save.
+    if(!decomp_valid(d)) {
+      decomp_free(d);
+      cache->dirty = 1;
+    } else if(!cache_push(cache, d)) {
+      decomp_free(d);
+      return;
+    }
+  }
+}
+
+decomp_cache *
+decomp_cache_new(const char *path) {
+  decomp_cache *cache = calloc(1, sizeof(decomp_cache));
+  if(cache == NULL || path == NULL) return cache;
+
+  cache->path = strdup(path);
+  FILE *f = fopen(path, "rb");
+  if(f) {
+    cache_load(cache, f);
+    fclose(f);
+  }
+  return cache;
+}
+
+void
+decomp_cache_free(decomp_cache *cache) {
+  if(cache == NULL) return;
+  for(int i=0; i<cache->num; i++) decomp_free(cache->entries[i]);
+  free(cache->entries);
+  free(cache->path);
+  free(cache);
+}
+
+int
+decomp_cache_dirty(const decomp_cache *cache) {
+  return cache->dirty;
+}
+
+int
+decomp_cache_save(decomp_cache *cache) {
+  if(cache->path == NULL || !cache->dirty) return 1;
+
+  FILE *f = fopen(cache->path, "wb");
+  if(f == NULL) return 0;
+
+  uint32_t header[3] = {DECOMP_MAGIC, DECOMP_VERSION, cache->num};
+  int ok = fwrite(header, sizeof(header), 1, f) == 1;
+  for(int i=0; i<cache->num && ok; i++) {
+    const decomp *d = cache->entries[i];
+    decomp_record rec = {d->key, d->area, d->moment, d->num_hulls, d->num_verts};
+    ok =
+      fwrite(&rec, sizeof(rec), 1, f) == 1 &&
+      fwrite(d->hull_counts, sizeof(int), d->num_hulls, f) == (size_t)d->num_hulls &&
+      fwrite(d->verts, sizeof(cpVect), d->num_verts, f) == (size_t)d->num_verts;
+  }
+
+  if(fclose(f) != 0 || !ok) {
+    remove(cache->path);
+    return 0;
+  }
+  cache->dirty = 0;
+  return 1;
+}
+
+// DECOMPOSITION
+
+// cpPolylineConvexDecomposition wants a closed, counterclockwise polyline.
+static cpPolyline *
+closed_polyline(const cpVect *outline, int count) {
+  int closed = cpveql(outline[0], outline[count - 1]);
+  int n = closed ? count : count + 1;
+
+  cpPolyline *line = malloc(sizeof(cpPolyline) + sizeof(cpVect)*n);
+  if(line == NULL) return NULL;
+  line->count    = n;
+  line->capacity = n;
+
+  int reverse = cpAreaForPoly(count, outline, 0.0f) < 0.0f;
+  for(int i=0; i<n - 1; i++) line->verts[i] = outline[reverse ? n - 2 - i : i];
+  line->verts[n - 1] = line->verts[0];
+  return line;
+}
+
+static decomp *
+decompose(const cpVect *outline, int count, cpFloat tolerance) {
+  cpPolyline *line = closed_polyline(outline, count);
+  if(line == NULL) return NULL;
+
+  cpPolylineSet *hulls = cpPolylineConvexDecomposition(line, tolerance);
+  free(line);
+  if(hulls == NULL) return NULL;
+
+  // Hull polylines are closed too; drop the repeated first vertex.
+  int num_verts = 0;
+  for(int i=0; i<hulls->count; i++) num_verts += hulls->lines[i]->count - 1;
+
+  decomp *d = decomp_alloc(hulls->count, num_verts);
+  if(d == NULL) {
+    cpPolylineSetFree(hulls, cpTrue);
+    return NULL;
+  }
+
+  cpVect  *v = d->verts;
+  cpVect   centroid = cpvzero;
+  for(int i=0; i<hulls->count; i++) {
+    cpPolyline *hull = hulls->lines[i];
+    int n = hull->count - 1;
+    memcpy(v, hull->verts, sizeof(cpVect)*n);
+
+    cpFloat area = cpAreaForPoly(n, v, 0.0f);
+    d->hull_counts[i] = n;
+    d->area += area;
+    centroid = cpvadd(centroid, cpvmult(cpCentroidForPoly(n, v), area));
+    v += n;
+  }
+  cpPolylineSetFree(hulls, cpTrue);
+
+  if(d->area <= 0.0f) {
+    decomp_free(d);
+    return NULL;
+  }
+  centroid = cpvmult(centroid, 1.0f/d->area);
+
+  // Recenter and sum each hull's moment at density 1 around the centroid.
+  v = d->verts;
+  for(int i=0; i<d->num_hulls; i++) {
+    int n = d->hull_counts[i];
+    for(int j=0; j<n; j++) v[j] = cpvsub(v[j], centroid);
+    d->moment += cpMomentForPoly(cpAreaForPoly(n, v, 0.0f), n, v, cpvzero, 0.0f);
+    v += n;
+  }
+  return d;
+}
+
+const decomp *
+decomp_get(decomp_cache *cache, const cpVect *outline, int count, cpFloat tolerance) {
+  if(count < 3) return NULL;
+
+  uint64_t key = outline_key(outline, count, tolerance);
+  for(int i=0; i<cache->num; i++) {
+    if(cache->entries[i]->key == key) return cache->entries[i];
+  }
+
+  decomp *d = decompose(outline, count, tolerance);
+  if(d == NULL) return NULL;
+  d->key = key;
+
+  if(!cache_push(cache, d)) {
+    decomp_free(d);
+    return NULL;
+  }
+  cache->dirty = 1;
+  return d;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <chipmunk/chipmunk.h>
+
+// Convex decomposition of concave outlines, cached per outline. Spawning many
+// copies of the same outline decomposes it once; with a cache file the result
+// also carries over to the next run.
+//
+// Hulls are stored around the area centroid of the whole outline, so they can
+// be attached to a body as they are, with its center of gravity at the body
+// position.
+typedef struct decomp {
+  uint64_t key;
+  cpFloat  area;         // summed over all hulls
+  cpFloat  moment;       // moment of inertia at density 1, around the centroid
+  int      num_hulls;
+  int     *hull_counts;  // vertexes of each hull, not repeating the first
+  int      num_verts;
+  cpVect  *verts;        // all hulls back to back, counterclockwise
+} decomp;
+
+typedef struct decomp_cache decomp_cache;
+
+// Loads the decompositions in path if it exists. path may be NULL to keep
+// the cache in memory only.
+decomp_cache * decomp_cache_new (const char *path);
+void           decomp_cache_free(decomp_cache *cache);
+
+// Nonzero if the cache differs from its file: entries were added, or bad
+// ones dropped while loading.
+int            decomp_cache_dirty(const decomp_cache *cache);
+
+// Write the cache back to its file if it is dirty. Returns 0 on failure.
+int            decomp_cache_save(decomp_cache *cache);
+
+// Decomposition of a simple (not self-intersecting) outline of either
+// winding, closed or not. tolerance is how deep a concavity may stay inside
+// one hull. The result belongs to the cache. NULL if the outline is
+// degenerate.
+const decomp * decomp_get(decomp_cache *cache, const cpVect *outline, int count, cpFloat tolerance);
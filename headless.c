@@ -0,0 +1,311 @@
+// Headless rendering: the demo's drawing code (sdl_draw.c) run on SDL's dummy
+// video driver, so it needs no display. The last frame can be written out as
+// a PPM and compared against a reference image within a tolerance, and the
+// time spent recording and rasterizing frames is reported apart from
+// presenting them, which the dummy driver makes free.
+//
+//   $ ./build_headless.sh
+//   $ ./chipmunk_headless -n 300 -o reference.ppm
+//   $ ./chipmunk_headless -n 300 -g reference.ppm -t 2 -D diff.ppm
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include <SDL/SDL.h>
+
+#include <chipmunk/chipmunk_private.h>
+#include <chipmunk/chipmunk.h>
+
+#include "space.h"
+#include "step.h"
+#include "raster.h"
+#include "pool.h"
+
+#define SCREEN_W  640
+#define SCREEN_H  480
+#define SCREEN_BG 0x000080
+
+#define STEP_DT   0.02
+
+static int  DrawDirty(cpSpace *space);
+static void InvalidateScreen(void);
+static void RenderStart(int threads);
+static void RenderSubmit(void);
+static void RenderWait(void);
+static void RenderStop(void);
+
+static SDL_Surface *screen = NULL;
+
+// IMAGES
+
+// 8 bit RGB, row by row, as stored in a binary PPM.
+typedef struct image {
+  int      width, height;
+  uint8_t *rgb;
+} image;
+
+static void
+surface_rgb(SDL_Surface *surface, image *img) {
+  img->width  = surface->w;
+  img->height = surface->h;
+  img->rgb    = malloc((size_t)surface->w*surface->h*3);
+
+  int      bpp = surface->format->BytesPerPixel;
+  uint8_t *out = img->rgb;
+  SDL_LockSurface(surface);
+  for(int y=0; y<surface->h; y++) {
+    const uint8_t *p = (const uint8_t *)surface->pixels + (size_t)y*surface->pitch;
+    for(int x=0; x<surface->w; x++, p += bpp, out += 3) {
+      Uint32 pixel;
+      switch(bpp) {
+        case 2: pixel = *(const Uint16 *)p; break;
+        case 4: pixel = *(const Uint32 *)p; break;
+        default:
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+          pixel = p[0] << 16 | p[1] << 8 | p[2];
+#else
+          pixel = p[0] | p[1] << 8 | p[2] << 16;
+#endif
+      }
+      SDL_GetRGB(pixel, surface->format, &out[0], &out[1], &out[2]);
+    }
+  }
+  SDL_UnlockSurface(surface);
+}
+
+static int
+write_ppm(const image *img, const char *path) {
+  FILE *f = fopen(path, "wb");
+  if(f == NULL) return 0;
+
+  size_t size = (size_t)img->width*img->height*3;
+  int ok = fprintf(f, "P6\n%d %d\n255\n", img->width, img->height) > 0 && fwrite(img->rgb, 1, size, f) == size;
+  return fclose(f) == 0 && ok;
+}
+
+// Next header number, skipping whitespace and comments.
+static int
+ppm_number(FILE *f) {
+  int c = fgetc(f);
+  while(c == '#' || (c != EOF && c <= ' ')) {
+    if(c == '#') {
+      while(c != '\n' && c != EOF) c = fgetc(f);
+    }
+    c = fgetc(f);
+  }
+
+  int n = -1;
+  while(c >= '0' && c <= '9') {
+    n = (n < 0 ? 0 : n*10) + c - '0';
+    c = fgetc(f);
+  }
+  return n;
+}
+
+// Binary PPMs with 8 bit samples only, which is what write_ppm produces.
+static int
+read_ppm(image *img, const char *path) {
+  FILE *f = fopen(path, "rb");
+  if(f == NULL) return 0;
+
+  int ok = 0;
+  if(fgetc(f) == 'P' && fgetc(f) == '6') {
+    img->width  = ppm_number(f);
+    img->height = ppm_number(f);
+    if(img->width > 0 && img->height > 0 && ppm_number(f) == 255) {
+      size_t size = (size_t)img->width*img->height*3;
+      img->rgb = malloc(size);
+      ok = fread(img->rgb, 1, size, f) == size;
+    }
+  }
+  fclose(f);
+  return ok;
+}
+
+// COMPARISON
+
+typedef struct compare_result {
+  int mismatched;  // pixels with a channel off by more than the tolerance
+  int max_diff;    // largest channel difference over all pixels
+} compare_result;
+
+// With diff set, it becomes a copy of expected darkened to a third, with
+// mismatched pixels in red.
+static void
+compare_images(const image *actual, const image *expected, int tolerance, compare_result *result, image *diff) {
+  result->mismatched = 0;
+  result->max_diff   = 0;
+
+  int      count = actual->width*actual->height;
+  uint8_t *d     = diff ? diff->rgb : NULL;
+  for(int i=0; i<count; i++) {
+    const uint8_t *a = actual->rgb + i*3, *e = expected->rgb + i*3;
+    int worst = 0;
+    for(int c=0; c<3; c++) {
+      int delta = abs(a[c] - e[c]);
+      if(delta > worst) worst = delta;
+    }
+    if(worst > result->max_diff) result->max_diff = worst;
+    if(worst > tolerance) result->mismatched++;
+
+    if(d) {
+      for(int c=0; c<3; c++) d[i*3 + c] = e[c]/3;
+      if(worst > tolerance) {
+        d[i*3 + 0] = 255;
+        d[i*3 + 1] = 0;
+        d[i*3 + 2] = 0;
+      }
+    }
+  }
+}
+
+static void
+usage(const char *prog) {
+  fprintf(stderr,
+    "usage: %s [-n frames] [-r rows] [-b bits] [-j threads] [-F] [-o out.ppm]\n"
+    "       [-g reference.ppm] [-t tolerance] [-m pixels] [-D diff.ppm]\n"
+    "  -n frames     steps to run, drawing a frame after each (default 300)\n"
+    "  -r rows       pyramid height (default 12)\n"
+    "  -b bits       screen depth, 16, 24 or 32 (default 24, like the demo)\n"
+    "  -j threads    rasterize on this many threads (default: CPUs less one)\n"
+    "  -F            redraw the whole screen every frame, not just what changed\n"
+    "  -o out.ppm    write the last frame\n"
+    "  -g ref.ppm    compare the last frame against ref.ppm, exit 1 on mismatch\n"
+    "  -t tolerance  largest channel difference a pixel may have (default 0)\n"
+    "  -m pixels     pixels allowed past the tolerance (default 0)\n"
+    "  -D diff.ppm   with -g, write the mismatched pixels over the reference\n",
+    prog);
+}
+
+int main(int argc, char **argv) {
+  int frames    = 300;
+  int bits      = 24;
+  int threads   = 0;
+  int full      = 0;
+  int tolerance = 0;
+  int allowed   = 0;
+  const char *out_path       = NULL;
+  const char *reference_path = NULL;
+  const char *diff_path      = NULL;
+
+  space_params params;
+  space_params_default(&params);
+
+  int opt;
+  while((opt = getopt(argc, argv, "n:r:b:j:Fo:g:t:m:D:h")) != -1) {
+    switch(opt) {
+      case 'n': frames                    = atoi(optarg); break;
+      case 'r': params.scene.pyramid_rows = atoi(optarg); break;
+      case 'b': bits                      = atoi(optarg); break;
+      case 'j': threads                   = atoi(optarg); break;
+      case 'F': full                      = 1;            break;
+      case 'o': out_path                  = optarg;       break;
+      case 'g': reference_path            = optarg;       break;
+      case 't': tolerance                 = atoi(optarg); break;
+      case 'm': allowed                   = atoi(optarg); break;
+      case 'D': diff_path                 = optarg;       break;
+      default : usage(argv[0]); return opt == 'h' ? 0 : 1;
+    }
+  }
+  if(frames <= 0 || threads < 0 || tolerance < 0 || allowed < 0 || (bits != 16 && bits != 24 && bits != 32)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // The dummy driver gives a regular software screen surface and makes
+  // SDL_UpdateRects a no-op; nothing else in the drawing code changes.
+  setenv("SDL_VIDEODRIVER", "dummy", 1);
+  if(SDL_Init(SDL_INIT_VIDEO) != 0) {
+    fprintf(stderr, "can't init SDL: %s\n", SDL_GetError());
+    return 1;
+  }
+
+  int width, height;
+  scene_extent(&params.scene, &width, &height);
+  width  = cpfmax(width, SCREEN_W);
+  height = cpfmax(height, SCREEN_H);
+
+  screen = SDL_SetVideoMode(width, height, bits, SDL_SWSURFACE);
+  if(screen == NULL) {
+    fprintf(stderr, "can't set video mode: %s\n", SDL_GetError());
+    return 1;
+  }
+
+  cpSpace *space = space_new(width, height, &params);
+  if(space == NULL) {
+    fprintf(stderr, "can't build the world\n");
+    return 1;
+  }
+  RenderStart(threads);
+
+  // Frames are drawn one at a time, waiting for each, so recording and
+  // rasterizing can be timed apart; the demo overlaps them with stepping.
+  uint64_t record = 0, render = 0;
+  int redrawn = 0;
+  for(int i=0; i<frames; i++) {
+    space_update(space, STEP_DT);
+    if(full) InvalidateScreen();
+
+    uint64_t t0 = step_now_ns();
+    if(DrawDirty(space) > 0) redrawn++;
+    uint64_t t1 = step_now_ns();
+    RenderSubmit();
+    RenderWait();
+    uint64_t t2 = step_now_ns();
+
+    record += t1 - t0;
+    render += t2 - t1;
+  }
+
+  printf("screen            %dx%d, %d bit\n", width, height, bits);
+  printf("frames            %d, %d redrawn\n", frames, redrawn);
+  printf("record            %.1f us/frame\n", record/1e3/frames);
+  printf("render            %.1f us/frame\n", render/1e3/frames);
+
+  image frame;
+  surface_rgb(screen, &frame);
+
+  int status = 0;
+  if(out_path && !write_ppm(&frame, out_path)) {
+    fprintf(stderr, "failed to write %s\n", out_path);
+    status = 1;
+  }
+
+  if(reference_path) {
+    image reference;
+    if(!read_ppm(&reference, reference_path)) {
+      fprintf(stderr, "can't read %s\n", reference_path);
+      status = 1;
+    } else if(reference.width != frame.width || reference.height != frame.height) {
+      fprintf(stderr, "%s is %dx%d, the frame %dx%d\n", reference_path, reference.width, reference.height, frame.width, frame.height);
+      free(reference.rgb);
+      status = 1;
+    } else {
+      image diff = {frame.width, frame.height, diff_path ? malloc((size_t)frame.width*frame.height*3) : NULL};
+
+      compare_result result;
+      compare_images(&frame, &reference, tolerance, &result, diff_path ? &diff : NULL);
+      printf("mismatched        %d pixels (tolerance %d, %d allowed)\n", result.mismatched, tolerance, allowed);
+      printf("max difference    %d\n", result.max_diff);
+
+      if(result.mismatched > allowed) status = 1;
+      if(diff_path && !write_ppm(&diff, diff_path)) {
+        fprintf(stderr, "failed to write %s\n", diff_path);
+        status = 1;
+      }
+      free(diff.rgb);
+      free(reference.rgb);
+    }
+  }
+  free(frame.rgb);
+
+  RenderStop();
+  space_destroy(space);
+  SDL_Quit();
+  return status;
+}
+
+#include "sdl_draw.c"
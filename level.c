@@ -0,0 +1,301 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chipmunk/chipmunk.h>
+#include <chipmunk/cpMarch.h>
+#include <chipmunk/cpPolyline.h>
+
+#include "level.h"
+
+#define LEVEL_MAGIC   0x636c766cu // "lvlc"
+#define LEVEL_VERSION 1
+
+// IMAGE
+
+typedef struct level_image {
+  int    width, height;
+  float *solid;  // darkness of each pixel in [0, 1], row by row
+} level_image;
+
+static int
+read_number(FILE *f) {
+  int c = fgetc(f);
+  for(;;) {
+    while(c != EOF && isspace(c)) c = fgetc(f);
+    if(c != '#') break;
+    while(c != EOF && c != '\n') c = fgetc(f);
+  }
+
+  int n = -1;
+  while(c != EOF && isdigit(c)) {
+    n = (n < 0 ? 0 : n*10) + (c - '0');
+    c = fgetc(f);
+  }
+  return n;
+}
+
+static int
+read_sample(FILE *f, int ascii, int maxval) {
+  if(ascii) return read_number(f);
+
+  int hi = fgetc(f);
+  if(hi == EOF || maxval < 256) return hi;
+  int lo = fgetc(f);
+  return lo == EOF ? -1 : hi << 8 | lo;
+}
+
+// P2/P5 graymaps and P3/P6 pixmaps. The single whitespace after the header
+// of the binary formats is eaten by read_number.
+static int
+image_read(FILE *f, level_image *img) {
+  char magic[2];
+  if(fread(magic, 1, 2, f) != 2 || magic[0] != 'P') return 0;
+
+  int channels, ascii;
+  switch(magic[1]) {
+    case '2': channels = 1; ascii = 1; break;
+    case '3': channels = 3; ascii = 1; break;
+    case '5': channels = 1; ascii = 0; break;
+    case '6': channels = 3; ascii = 0; break;
+    default : return 0;
+  }
+
+  img->width  = read_number(f);
+  img->height = read_number(f);
+  int maxval  = read_number(f);
+  if(img->width <= 0 || img->height <= 0 || maxval <= 0 || maxval > 65535) return 0;
+
+  img->solid = malloc(sizeof(float)*img->width*img->height);
+  if(img->solid == NULL) return 0;
+
+  for(int i=0; i<img->width*img->height; i++) {
+    int sum = 0;
+    for(int c=0; c<channels; c++) {
+      int v = read_sample(f, ascii, maxval);
+      if(v < 0) return 0;
+      sum += v;
+    }
+    img->solid[i] = 1.0f - (float)sum/(channels*maxval);
+  }
+  return 1;
+}
+
+// Pixels outside the image are empty so outlines touching the border close.
+static cpFloat
+image_sample(cpVect point, level_image *img) {
+  int x = (int)(point.x + 0.5f), y = (int)(point.y + 0.5f);
+  if(x < 0 || y < 0 || x >= img->width || y >= img->height) return 0.0f;
+  return img->solid[y*img->width + x];
+}
+
+// CACHE
+
+typedef struct level_header {
+  uint32_t magic, version;
+  uint64_t key;
+  int32_t  width, height;
+  int32_t  num_chains, num_verts;
+} level_header;
+
+// FNV-1a over the image bytes and the compile options.
+static uint64_t
+hash_bytes(uint64_t h, const void *data, size_t size) {
+  const unsigned char *p = data;
+  for(size_t i=0; i<size; i++) {
+    h ^= p[i];
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+static int
+file_key(FILE *f, cpFloat threshold, cpFloat tolerance, uint64_t *key) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  unsigned char buf[1 << 16];
+  size_t n;
+  while((n = fread(buf, 1, sizeof(buf), f)) > 0) h = hash_bytes(h, buf, n);
+  if(ferror(f)) return 0;
+
+  h = hash_bytes(h, &threshold, sizeof(threshold));
+  h = hash_bytes(h, &tolerance, sizeof(tolerance));
+  *key = h;
+  return 1;
+}
+
+level *
+level_new(int width, int height, int num_chains, int num_verts) {
+  level *lvl = calloc(1, sizeof(level));
+  if(lvl == NULL) return NULL;
+
+  lvl->width        = width;
+  lvl->height       = height;
+  lvl->num_chains   = num_chains;
+  lvl->num_verts    = num_verts;
+  lvl->chain_counts = malloc(sizeof(int)*(num_chains ? num_chains : 1));
+  lvl->verts        = malloc(sizeof(cpVect)*(num_verts ? num_verts : 1));
+  if(lvl->chain_counts == NULL || lvl->verts == NULL) {
+    level_free(lvl);
+    return NULL;
+  }
+  return lvl;
+}
+
+static level *
+cache_read(const char *path, uint64_t key) {
+  FILE *f = fopen(path, "rb");
+  if(f == NULL) return NULL;
+
+  level_header header;
+  level *lvl = NULL;
+  if(
+    fread(&header, sizeof(header), 1, f) == 1 &&
+    header.magic == LEVEL_MAGIC && header.version == LEVEL_VERSION && header.key == key &&
+    header.num_chains >= 0 && header.num_verts >= 0
+  ) {
+    lvl = level_new(header.width, header.height, header.num_chains, header.num_verts);
+  }
+
+  // Counts that don't add up would send level_add past the vertexes; such a
+  // cache is dropped and the image traced again.
+  if(lvl && (
+    fread(lvl->chain_counts, sizeof(int), lvl->num_chains, f) != (size_t)lvl->num_chains ||
+    fread(lvl->verts, sizeof(cpVect), lvl->num_verts, f) != (size_t)lvl->num_verts ||
+    !level_valid(lvl)
+  )) {
+    level_free(lvl);
+    lvl = NULL;
+  }
+  fclose(f);
+  return lvl;
+}
+
+static void
+cache_write(const char *path, uint64_t key, const level *lvl) {
+  FILE *f = fopen(path, "wb");
+  if(f == NULL) return;
+
+  level_header header;
+  memset(&header, 0, sizeof(header));
+  header.magic      = LEVEL_MAGIC;
+  header.version    = LEVEL_VERSION;
+  header.key        = key;
+  header.width      = lvl->width;
+  header.height     = lvl->height;
+  header.num_chains = lvl->num_chains;
+  header.num_verts  = lvl->num_verts;
+
+  int ok =
+    fwrite(&header, sizeof(header), 1, f) == 1 &&
+    fwrite(lvl->chain_counts, sizeof(int), lvl->num_chains, f) == (size_t)lvl->num_chains &&
+    fwrite(lvl->verts, sizeof(cpVect), lvl->num_verts, f) == (size_t)lvl->num_verts;
+
+  // A partial cache would only be rejected on the next load; drop it now.
+  if(fclose(f) != 0 || !ok) remove(path);
+}
+
+// COMPILE
+
+static level *
+compile(const level_image *img, cpFloat threshold, cpFloat tolerance) {
+  cpPolylineSet *set = cpPolylineSetNew();
+
+  // One sample per pixel plus a ring of empty samples around the image.
+  cpBB bb = cpBBNew(-1.0f, -1.0f, img->width, img->height);
+  cpMarchSoft(bb, img->width + 2, img->height + 2, threshold,
+    (cpMarchSegmentFunc)cpPolylineSetCollectSegment, set,
+    (cpMarchSampleFunc)image_sample, (void *)img);
+
+  cpPolyline **lines = malloc(sizeof(cpPolyline *)*(set->count ? set->count : 1));
+  if(lines == NULL) {
+    cpPolylineSetFree(set, cpTrue);
+    return NULL;
+  }
+
+  int num_verts = 0;
+  for(int i=0; i<set->count; i++) {
+    lines[i] = cpPolylineSimplifyCurves(set->lines[i], tolerance);
+    num_verts += lines[i]->count;
+  }
+
+  level *lvl = level_new(img->width, img->height, set->count, num_verts);
+  if(lvl) {
+    cpVect *v = lvl->verts;
+    for(int i=0; i<set->count; i++) {
+      lvl->chain_counts[i] = lines[i]->count;
+      memcpy(v, lines[i]->verts, sizeof(cpVect)*lines[i]->count);
+      v += lines[i]->count;
+    }
+  }
+
+  for(int i=0; i<set->count; i++) cpPolylineFree(lines[i]);
+  free(lines);
+  cpPolylineSetFree(set, cpTrue);
+  return lvl;
+}
+
+level *
+level_load(const char *image, const char *cache, cpFloat threshold, cpFloat tolerance) {
+  FILE *f = fopen(image, "rb");
+  if(f == NULL) return NULL;
+
+  uint64_t key = 0;
+  level *lvl = NULL;
+  if(cache) {
+    if(!file_key(f, threshold, tolerance, &key)) {
+      fclose(f);
+      return NULL;
+    }
+    lvl = cache_read(cache, key);
+    if(lvl) {
+      fclose(f);
+      return lvl;
+    }
+    rewind(f);
+  }
+
+  level_image img = {0, 0, NULL};
+  if(image_read(f, &img)) lvl = compile(&img, threshold, tolerance);
+  free(img.solid);
+  fclose(f);
+
+  if(lvl && cache) cache_write(cache, key, lvl);
+  return lvl;
+}
+
+int
+level_valid(const level *lvl) {
+  if(lvl->num_chains < 0 || lvl->num_verts < 0) return 0;
+
+  long total = 0;
+  for(int i=0; i<lvl->num_chains; i++) {
+    if(lvl->chain_counts[i] < 2) return 0;
+    total += lvl->chain_counts[i];
+  }
+  return total == lvl->num_verts;
+}
+
+void
+level_free(level *lvl) {
+  if(lvl == NULL) return;
+  free(lvl->chain_counts);
+  free(lvl->verts);
+  free(lvl);
+}
+
+void
+level_add(const level *lvl, cpSpace *space, cpFloat radius) {
+  cpBody *body = cpSpaceGetStaticBody(space);
+
+  const cpVect *v = lvl->verts;
+  for(int i=0; i<lvl->num_chains; i++) {
+    for(int j=1; j<lvl->chain_counts[i]; j++) {
+      cpShape *shape = space_add_static_shape(space, cpSegmentShapeNew(body, v[j - 1], v[j], radius));
+      cpShapeSetElasticity(shape, 1.0f);
+      cpShapeSetFriction(shape, 1.0f);
+      cpShapeSetFilter(shape, NOT_GRABBABLE_FILTER);
+    }
+    v += lvl->chain_counts[i];
+  }
+}
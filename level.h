@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "space.h"
+
+// Static level geometry compiled from a grayscale or color bitmap (binary or
+// ASCII PGM/PPM). Dark pixels are solid: the image is marched with cpMarchSoft
+// into outlines, which cpPolylineSimplifyCurves reduces to chains of static
+// segments. One pixel is one world unit, with y down like the screen.
+typedef struct level {
+  int       width, height;  // image size
+  int       num_chains;
+  int      *chain_counts;   // vertexes in each chain
+  int       num_verts;
+  cpVect   *verts;          // all chains back to back
+} level;
+
+// Compile image, or load it from cache when the cache was compiled from the
+// same image bytes with the same threshold and tolerance. A stale or missing
+// cache is rewritten; cache may be NULL to always compile.
+//
+//   threshold  darkness in [0, 1] where solid begins, 0.5 for clean images
+//   tolerance  how far simplified chains may stray from the outline, in px
+level * level_load   (const char *image, const char *cache, cpFloat threshold, cpFloat tolerance);
+void    level_free   (level *lvl);
+
+// A level with room for the given chains and vertexes, both left unset.
+level * level_new    (int width, int height, int num_chains, int num_verts);
+
+// Nonzero if every chain has at least two vertexes and the chains add up to
+// num_verts, so level_add stays inside verts.
+int     level_valid  (const level *lvl);
+
+// Add every chain to the static body of space as segments of the given
+// radius, with the same material and filter as the scene walls.
+void    level_add    (const level *lvl, cpSpace *space, cpFloat radius);
@@ -0,0 +1,193 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "pool.h"
+
+// The indices left to a worker, [lo, hi). The owner takes from the bottom,
+// thieves split off the top half. Padded to a cache line so owners don't
+// fight over each other's lines.
+typedef struct pool_queue {
+  pthread_mutex_t lock;
+  int             lo, hi;
+  char            pad[64];
+} pool_queue;
+
+typedef struct pool_worker {
+  pool *p;
+  int   id;
+} pool_worker;
+
+struct pool {
+  int          threads;
+  pthread_t   *handles;
+  pool_worker *workers;
+  pool_queue  *queues;
+
+  pthread_mutex_t lock;
+  pthread_cond_t  start, done;
+  unsigned        generation;  // bumped by every pool_run
+  int             busy;        // workers not done with the current run
+  int             quit;
+
+  pool_func func;
+  void     *data;
+};
+
+static int
+take(pool_queue *q) {
+  int index = -1;
+  pthread_mutex_lock(&q->lock);
+  if(q->lo < q->hi) index = q->lo++;
+  pthread_mutex_unlock(&q->lock);
+  return index;
+}
+
+// Move the top half of some other worker's indices into our own queue.
+static int
+steal(pool *p, int id) {
+  for(int i=1; i<p->threads; i++) {
+    pool_queue *victim = &p->queues[(id + i)%p->threads];
+
+    pthread_mutex_lock(&victim->lock);
+    int lo = victim->lo, hi = victim->hi;
+    int mid = lo + (hi - lo)/2;
+    if(lo < hi) victim->hi = mid;
+    pthread_mutex_unlock(&victim->lock);
+
+    if(lo < hi) {
+      pool_queue *own = &p->queues[id];
+      pthread_mutex_lock(&own->lock);
+      own->lo = mid;
+      own->hi = hi;
+      pthread_mutex_unlock(&own->lock);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void
+work(pool *p, int id) {
+  for(;;) {
+    int index = take(&p->queues[id]);
+    if(index >= 0) {
+      p->func(p->data, index, id);
+    } else if(!steal(p, id)) {
+      return;
+    }
+  }
+}
+
+static void *
+worker_main(void *arg) {
+  pool_worker *worker = arg;
+  pool *p = worker->p;
+  unsigned seen = 0;
+
+  pthread_mutex_lock(&p->lock);
+  for(;;) {
+    while(p->generation == seen && !p->quit) pthread_cond_wait(&p->start, &p->lock);
+    if(p->quit) break;
+    seen = p->generation;
+    pthread_mutex_unlock(&p->lock);
+
+    work(p, worker->id);
+
+    pthread_mutex_lock(&p->lock);
+    if(--p->busy == 0) pthread_cond_signal(&p->done);
+  }
+  pthread_mutex_unlock(&p->lock);
+  return NULL;
+}
+
+pool *
+pool_new(int threads) {
+  if(threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if(threads <= 0) threads = 1;
+
+  pool *p = calloc(1, sizeof(pool));
+  if(p == NULL) return NULL;
+
+  p->threads = threads;
+  p->handles = calloc(threads, sizeof(pthread_t));
+  p->workers = calloc(threads, sizeof(pool_worker));
+  p->queues  = calloc(threads, sizeof(pool_queue));
+  if(p->handles == NULL || p->workers == NULL || p->queues == NULL) {
+    free(p->handles);
+    free(p->workers);
+    free(p->queues);
+    free(p);
+    return NULL;
+  }
+
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->start, NULL);
+  pthread_cond_init(&p->done, NULL);
+  for(int i=0; i<threads; i++) {
+    pthread_mutex_init(&p->queues[i].lock, NULL);
+    p->workers[i].p  = p;
+    p->workers[i].id = i;
+  }
+
+  // Worker 0 is whoever calls pool_run.
+  for(int i=1; i<threads; i++) {
+    if(pthread_create(&p->handles[i], NULL, worker_main, &p->workers[i]) != 0) {
+      p->threads = i;
+      break;
+    }
+  }
+  return p;
+}
+
+void
+pool_free(pool *p) {
+  if(p == NULL) return;
+
+  pthread_mutex_lock(&p->lock);
+  p->quit = 1;
+  pthread_cond_broadcast(&p->start);
+  pthread_mutex_unlock(&p->lock);
+  for(int i=1; i<p->threads; i++) pthread_join(p->handles[i], NULL);
+
+  for(int i=0; i<p->threads; i++) pthread_mutex_destroy(&p->queues[i].lock);
+  pthread_cond_destroy(&p->done);
+  pthread_cond_destroy(&p->start);
+  pthread_mutex_destroy(&p->lock);
+
+  free(p->handles);
+  free(p->workers);
+  free(p->queues);
+  free(p);
+}
+
+int
+pool_threads(const pool *p) {
+  return p->threads;
+}
+
+void
+pool_run(pool *p, int count, pool_func func, void *data) {
+  if(count <= 0) return;
+
+  for(int i=0; i<p->threads; i++) {
+    pthread_mutex_lock(&p->queues[i].lock);
+    p->queues[i].lo = (int)((long long)count*i/p->threads);
+    p->queues[i].hi = (int)((long long)count*(i + 1)/p->threads);
+    pthread_mutex_unlock(&p->queues[i].lock);
+  }
+
+  pthread_mutex_lock(&p->lock);
+  p->func = func;
+  p->data = data;
+  p->busy = p->threads - 1;
+  p->generation++;
+  pthread_cond_broadcast(&p->start);
+  pthread_mutex_unlock(&p->lock);
+
+  work(p, 0);
+
+  pthread_mutex_lock(&p->lock);
+  while(p->busy > 0) pthread_cond_wait(&p->done, &p->lock);
+  pthread_mutex_unlock(&p->lock);
+}
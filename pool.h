@@ -0,0 +1,21 @@
+#pragma once
+
+// Fixed set of worker threads running indexed jobs. Each worker starts with
+// an equal slice of the indices and steals half of the remaining slice of
+// another worker once its own runs dry, so jobs of very different length
+// still keep every thread busy.
+typedef struct pool pool;
+
+// Called once for every index in [0, count). worker is in [0, pool_threads)
+// and stays the same for everything one thread runs, for per-thread scratch.
+typedef void (*pool_func)(void *data, int index, int worker);
+
+// threads counts the calling thread, which works along in pool_run. 0 picks
+// the number of online CPUs.
+pool * pool_new    (int threads);
+void   pool_free   (pool *p);
+int    pool_threads(const pool *p);
+
+// Blocks until func has run for every index. Not reentrant: func must not
+// call pool_run on the same pool.
+void   pool_run    (pool *p, int count, pool_func func, void *data);
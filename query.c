@@ -0,0 +1,134 @@
+#include "space.h"
+#include "pool.h"
+
+// cpSpaceSegmentQueryFirst and cpSpacePointQueryNearest lock the space around
+// the index query, which isn't safe from several threads at once. These go to
+// the spatial indexes directly and keep the same filtering rules: filtered
+// out shapes and sensors never count.
+
+// Queries handed to one pool job.
+#define QUERY_CHUNK 64
+
+typedef struct segment_batch {
+  cpSpace            *space;
+  const cpVect       *start, *end;
+  int                 count;
+  cpFloat             radius;
+  cpShapeFilter       filter;
+  cpSegmentQueryInfo *out;
+} segment_batch;
+
+typedef struct segment_context {
+  cpVect        start, end;
+  cpFloat       radius;
+  cpShapeFilter filter;
+} segment_context;
+
+static cpFloat
+segment_first(segment_context *context, cpShape *shape, cpSegmentQueryInfo *out) {
+  cpSegmentQueryInfo info;
+  if(
+    !cpShapeFilterReject(shape->filter, context->filter) && !shape->sensor &&
+    cpShapeSegmentQuery(shape, context->start, context->end, context->radius, &info) &&
+    info.alpha < out->alpha
+  ) {
+    *out = info;
+  }
+  return out->alpha;
+}
+
+static void
+segment_query(cpSpace *space, segment_context *context, cpSegmentQueryInfo *out) {
+  cpSegmentQueryInfo none = {NULL, context->end, cpvzero, 1.0f};
+  *out = none;
+
+  cpSpatialIndexSegmentQuery(space->staticShapes, context, context->start, context->end, 1.0f,
+    (cpSpatialIndexSegmentQueryFunc)segment_first, out);
+  cpSpatialIndexSegmentQuery(space->dynamicShapes, context, context->start, context->end, out->alpha,
+    (cpSpatialIndexSegmentQueryFunc)segment_first, out);
+}
+
+static void
+segment_chunk(segment_batch *batch, int chunk, int worker) {
+  int first = chunk*QUERY_CHUNK;
+  int last  = first + QUERY_CHUNK < batch->count ? first + QUERY_CHUNK : batch->count;
+
+  segment_context context = {cpvzero, cpvzero, batch->radius, batch->filter};
+  for(int i=first; i<last; i++) {
+    context.start = batch->start[i];
+    context.end   = batch->end[i];
+    segment_query(batch->space, &context, &batch->out[i]);
+  }
+}
+
+void
+space_segment_query_batch(cpSpace *space, pool *pool, const cpVect *start, const cpVect *end, int count,
+                          cpFloat radius, cpShapeFilter filter, cpSegmentQueryInfo *out) {
+  segment_batch batch = {space, start, end, count, radius, filter, out};
+  int chunks = (count + QUERY_CHUNK - 1)/QUERY_CHUNK;
+
+  if(pool && space_get_index(space) != SPACE_INDEX_HASH) {
+    pool_run(pool, chunks, (pool_func)segment_chunk, &batch);
+  } else {
+    for(int i=0; i<chunks; i++) segment_chunk(&batch, i, 0);
+  }
+}
+
+typedef struct point_batch {
+  cpSpace          *space;
+  const cpVect     *points;
+  int               count;
+  cpFloat           max_distance;
+  cpShapeFilter     filter;
+  cpPointQueryInfo *out;
+} point_batch;
+
+typedef struct point_context {
+  cpVect        point;
+  cpShapeFilter filter;
+} point_context;
+
+static cpCollisionID
+point_nearest(point_context *context, cpShape *shape, cpCollisionID id, cpPointQueryInfo *out) {
+  if(!cpShapeFilterReject(shape->filter, context->filter) && !shape->sensor) {
+    cpPointQueryInfo info;
+    cpShapePointQuery(shape, context->point, &info);
+    if(info.distance < out->distance) *out = info;
+  }
+  return id;
+}
+
+static void
+point_query(cpSpace *space, point_context *context, cpFloat max_distance, cpPointQueryInfo *out) {
+  cpPointQueryInfo none = {NULL, cpvzero, max_distance, cpvzero};
+  *out = none;
+
+  cpBB bb = cpBBNewForCircle(context->point, cpfmax(max_distance, 0.0f));
+  cpSpatialIndexQuery(space->dynamicShapes, context, bb, (cpSpatialIndexQueryFunc)point_nearest, out);
+  cpSpatialIndexQuery(space->staticShapes,  context, bb, (cpSpatialIndexQueryFunc)point_nearest, out);
+}
+
+static void
+point_chunk(point_batch *batch, int chunk, int worker) {
+  int first = chunk*QUERY_CHUNK;
+  int last  = first + QUERY_CHUNK < batch->count ? first + QUERY_CHUNK : batch->count;
+
+  point_context context = {cpvzero, batch->filter};
+  for(int i=first; i<last; i++) {
+    context.point = batch->points[i];
+    point_query(batch->space, &context, batch->max_distance, &batch->out[i]);
+  }
+}
+
+void
+space_point_query_batch(cpSpace *space, pool *pool, const cpVect *points, int count,
+                        cpFloat max_distance, cpShapeFilter filter, cpPointQueryInfo *out) {
+  point_batch batch = {space, points, count, max_distance, filter, out};
+  int chunks = (count + QUERY_CHUNK - 1)/QUERY_CHUNK;
+
+  if(pool && space_get_index(space) != SPACE_INDEX_HASH) {
+    pool_run(pool, chunks, (pool_func)point_chunk, &batch);
+  } else {
+    for(int i=0; i<chunks; i++) point_chunk(&batch, i, 0);
+  }
+}
@@ -0,0 +1,247 @@
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "raster.h"
+
+void
+raster_target_init(raster_target *t, void *pixels, int w, int h, int pitch, int bpp) {
+  t->pixels = pixels;
+  t->pitch  = pitch;
+  t->bpp    = bpp;
+  t->x0     = 0;
+  t->y0     = 0;
+  t->x1     = w;
+  t->y1     = h;
+}
+
+// SPANS
+
+static void
+span32(uint32_t *p, int n, uint32_t color) {
+#if defined(__SSE2__)
+  __m128i c = _mm_set1_epi32((int)color);
+  for(; n >= 4; n -= 4, p += 4) _mm_storeu_si128((__m128i *)p, c);
+#endif
+  while(n-- > 0) *p++ = color;
+}
+
+static void
+span16(uint16_t *p, int n, uint16_t color) {
+#if defined(__SSE2__)
+  __m128i c = _mm_set1_epi16((short)color);
+  for(; n >= 8; n -= 8, p += 8) _mm_storeu_si128((__m128i *)p, c);
+#endif
+  while(n-- > 0) *p++ = color;
+}
+
+// Three bytes per pixel repeat every four pixels, so the span is filled with
+// a 12 byte pattern three words at a time.
+static void
+span24(uint8_t *p, int n, uint32_t color) {
+  uint8_t b[3];
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  b[0] = color >> 16; b[1] = color >> 8; b[2] = color;
+#else
+  b[0] = color; b[1] = color >> 8; b[2] = color >> 16;
+#endif
+
+  uint8_t pattern[12];
+  for(int i=0; i<12; i++) pattern[i] = b[i%3];
+  uint32_t w[3];
+  memcpy(w, pattern, sizeof(w));
+
+  for(; n >= 4; n -= 4, p += 12) {
+    memcpy(p + 0, &w[0], 4);
+    memcpy(p + 4, &w[1], 4);
+    memcpy(p + 8, &w[2], 4);
+  }
+  for(; n > 0; n--, p += 3) {
+    p[0] = b[0];
+    p[1] = b[1];
+    p[2] = b[2];
+  }
+}
+
+void
+raster_span(const raster_target *t, int y, int x0, int x1, uint32_t color) {
+  uint8_t *row = t->pixels + (size_t)y*t->pitch;
+  switch(t->bpp) {
+    case 4: span32((uint32_t *)row + x0, x1 - x0, color); break;
+    case 3: span24(row + x0*3, x1 - x0, color); break;
+    case 2: span16((uint16_t *)row + x0, x1 - x0, (uint16_t)color); break;
+  }
+}
+
+// CONVEX POLYGONS
+
+// One side of the polygon, walked from the top vertex down in one direction
+// round the vertex list.
+typedef struct chain {
+  const cpVect *verts;
+  int           count, dir;
+  int           cur, next, left;  // left: edges not walked yet
+  double        x, slope;         // x at y of cur, dx/dy of the current edge
+} chain;
+
+static void
+chain_edge(chain *c) {
+  cpVect a = c->verts[c->cur], b = c->verts[c->next];
+  c->x     = a.x;
+  c->slope = b.y > a.y ? (b.x - a.x)/(b.y - a.y) : 0.0;
+}
+
+static void
+chain_init(chain *c, const cpVect *verts, int count, int top, int dir) {
+  c->verts = verts;
+  c->count = count;
+  c->dir   = dir;
+  c->cur   = top;
+  c->next  = (top + dir + count)%count;
+  c->left  = count - 1;
+  chain_edge(c);
+}
+
+// x of the chain at scanline center yc, which only ever increases.
+static double
+chain_x(chain *c, double yc) {
+  while(c->left > 0 && c->verts[c->next].y < yc) {
+    c->cur  = c->next;
+    c->next = (c->cur + c->dir + c->count)%c->count;
+    c->left--;
+    chain_edge(c);
+  }
+  return c->x + (yc - c->verts[c->cur].y)*c->slope;
+}
+
+void
+raster_fill_convex(const raster_target *t, int count, const cpVect *verts, uint32_t color) {
+  if(count < 3) return;
+
+  int top = 0;
+  double ymin = verts[0].y, ymax = verts[0].y;
+  for(int i=1; i<count; i++) {
+    if(verts[i].y < ymin) {
+      ymin = verts[i].y;
+      top  = i;
+    }
+    if(verts[i].y > ymax) ymax = verts[i].y;
+  }
+
+  // Rows whose centers lie in [ymin, ymax).
+  int y0 = (int)ceil(ymin - 0.5), y1 = (int)ceil(ymax - 0.5);
+  if(y0 < t->y0) y0 = t->y0;
+  if(y1 > t->y1) y1 = t->y1;
+  if(y0 >= y1) return;
+
+  chain a, b;
+  chain_init(&a, verts, count, top, +1);
+  chain_init(&b, verts, count, top, -1);
+
+  for(int y=y0; y<y1; y++) {
+    double yc = y + 0.5;
+    double xa = chain_x(&a, yc), xb = chain_x(&b, yc);
+    if(xa > xb) {
+      double tmp = xa;
+      xa = xb;
+      xb = tmp;
+    }
+
+    int x0 = (int)ceil(xa - 0.5), x1 = (int)ceil(xb - 0.5);
+    if(x0 < t->x0) x0 = t->x0;
+    if(x1 > t->x1) x1 = t->x1;
+    if(x0 < x1) raster_span(t, y, x0, x1, color);
+  }
+}
+
+// CIRCLES AND LINES
+
+static inline void
+plot(const raster_target *t, int x, int y, uint32_t color) {
+  if(x >= t->x0 && x < t->x1 && y >= t->y0 && y < t->y1) raster_span(t, y, x, x + 1, color);
+}
+
+void
+raster_fill_circle(const raster_target *t, cpVect c, cpFloat r, uint32_t color) {
+  if(r <= 0.0f) return;
+
+  int y0 = (int)ceil(c.y - r - 0.5), y1 = (int)ceil(c.y + r - 0.5);
+  if(y0 < t->y0) y0 = t->y0;
+  if(y1 > t->y1) y1 = t->y1;
+
+  for(int y=y0; y<y1; y++) {
+    double dy = y + 0.5 - c.y;
+    double hw = r*r - dy*dy;
+    if(hw <= 0.0) continue;
+    hw = sqrt(hw);
+
+    int x0 = (int)ceil(c.x - hw - 0.5), x1 = (int)ceil(c.x + hw - 0.5);
+    if(x0 < t->x0) x0 = t->x0;
+    if(x1 > t->x1) x1 = t->x1;
+    if(x0 < x1) raster_span(t, y, x0, x1, color);
+  }
+}
+
+// Midpoint circle, eight octants at a time.
+void
+raster_circle(const raster_target *t, cpVect c, int r, uint32_t color) {
+  int cx = (int)floor(c.x), cy = (int)floor(c.y);
+  if(cx + r < t->x0 || cx - r >= t->x1 || cy + r < t->y0 || cy - r >= t->y1) return;
+
+  int x = r, y = 0, err = 1 - r;
+  while(x >= y) {
+    plot(t, cx + x, cy + y, color);
+    plot(t, cx - x, cy + y, color);
+    plot(t, cx + x, cy - y, color);
+    plot(t, cx - x, cy - y, color);
+    plot(t, cx + y, cy + x, color);
+    plot(t, cx - y, cy + x, color);
+    plot(t, cx + y, cy - x, color);
+    plot(t, cx - y, cy - x, color);
+
+    y++;
+    if(err < 0) {
+      err += 2*y + 1;
+    } else {
+      x--;
+      err += 2*(y - x) + 1;
+    }
+  }
+}
+
+// One pixel per step along the major axis. Steps outside the clip rect on
+// that axis are skipped up front, so a long line costs little in a tile it
+// barely touches.
+void
+raster_line(const raster_target *t, cpVect a, cpVect b, uint32_t color) {
+  double dx = b.x - a.x, dy = b.y - a.y;
+  int n = (int)ceil(fmax(fabs(dx), fabs(dy)));
+  if(n == 0) {
+    plot(t, (int)floor(a.x), (int)floor(a.y), color);
+    return;
+  }
+
+  double sx = dx/n, sy = dy/n;
+  int first = 0, last = n;
+  int    major = fabs(dx) >= fabs(dy);
+  double p     = major ? a.x : a.y;
+  double step  = major ? sx : sy;
+  double lo    = major ? t->x0 : t->y0;
+  double hi    = major ? t->x1 : t->y1;
+
+  // Steps i with lo <= p + step*i < hi, one wider on both ends against
+  // rounding; plot does the exact test.
+  double i0 = (lo - p)/step, i1 = (hi - p)/step;
+  if(step < 0.0) {
+    double tmp = i0;
+    i0 = i1;
+    i1 = tmp;
+  }
+  first = (int)fmax(first, floor(i0) - 1);
+  last  = (int)fmin(last, ceil(i1) + 1);
+
+  for(int i=first; i<=last; i++) plot(t, (int)floor(a.x + sx*i), (int)floor(a.y + sy*i), color);
+}
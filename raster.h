@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <chipmunk/chipmunk.h>
+
+// Software rasterizer for the shapes Chipmunk hands to the debug draw
+// callbacks, writing straight into a block of pixels. It knows nothing about
+// SDL: colors are already mapped pixel values (SDL_MapRGB) and the target is
+// any 16, 24 or 32 bit surface, row by row.
+typedef struct raster_target {
+  uint8_t *pixels;
+  int      pitch;           // bytes per row
+  int      bpp;             // bytes per pixel: 2, 3 or 4
+  int      x0, y0, x1, y1;  // clip rect, [x0, x1) x [y0, y1)
+} raster_target;
+
+// Target covering a whole w x h image.
+void raster_target_init(raster_target *t, void *pixels, int w, int h, int pitch, int bpp);
+
+// Fill pixels x0 <= x < x1 of row y, already clipped.
+void raster_span       (const raster_target *t, int y, int x0, int x1, uint32_t color);
+
+// Fill a convex polygon of either winding. Vertexes keep their subpixel
+// position; a pixel is covered when its center is inside, with the usual
+// top-left rule so shapes sharing an edge don't overlap or leave gaps.
+void raster_fill_convex(const raster_target *t, int count, const cpVect *verts, uint32_t color);
+
+// Fill a circle, covering pixels whose centers are inside like polygons.
+void raster_fill_circle(const raster_target *t, cpVect c, cpFloat r, uint32_t color);
+
+// One pixel wide outline of radius r around the pixel holding c.
+void raster_circle     (const raster_target *t, cpVect c, int r, uint32_t color);
+
+// One pixel wide line from a to b, both ends included.
+void raster_line       (const raster_target *t, cpVect a, cpVect b, uint32_t color);
@@ -0,0 +1,174 @@
+// Headless drawing benchmark: the demo scene drawn into an offscreen SDL
+// surface, comparing SDL_gfx against the rasterizer in raster.c.
+//
+//   $ ./build_render_bench.sh
+//   $ ./chipmunk_render_bench -n 500
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <SDL/SDL.h>
+#include <SDL/SDL_gfxPrimitives.h>
+
+#include "space.h"
+#include "step.h"
+#include "raster.h"
+
+#define SCREEN_W  640
+#define SCREEN_H  480
+
+static SDL_Surface  *surface;
+static raster_target target;
+
+static void
+DrawNothingCircle(cpVect p, cpFloat a, cpFloat r, cpSpaceDebugColor outline, cpSpaceDebugColor fill, cpDataPointer data) {}
+
+static void
+DrawNothingSegment(cpVect a, cpVect b, cpSpaceDebugColor color, cpDataPointer data) {}
+
+static void
+DrawNothingFatSegment(cpVect a, cpVect b, cpFloat r, cpSpaceDebugColor outline, cpSpaceDebugColor fill, cpDataPointer data) {}
+
+static void
+DrawNothingDot(cpFloat size, cpVect p, cpSpaceDebugColor color, cpDataPointer data) {}
+
+// The old DrawPolygon from sdl_draw.c.
+static void
+DrawPolygonGfx(int count, const cpVect *verts, cpFloat r, cpSpaceDebugColor outline, cpSpaceDebugColor fill, cpDataPointer data) {
+  Uint32 c =
+    ((Uint32)(fill.r*255)<<24)|
+    ((Uint32)(fill.g*255)<<16)|
+    ((Uint32)(fill.b*255)<< 8)|0xFF;
+
+  Sint16 vx[count], vy[count];
+  for(int i=0; i<count; i++) {
+    vx[i] = verts[i].x;
+    vy[i] = verts[i].y;
+  }
+  filledPolygonColor(surface, vx, vy, count, c);
+}
+
+static void
+DrawPolygonRaster(int count, const cpVect *verts, cpFloat r, cpSpaceDebugColor outline, cpSpaceDebugColor fill, cpDataPointer data) {
+  Uint32 c = SDL_MapRGB(surface->format, fill.r*255, fill.g*255, fill.b*255);
+  raster_fill_convex(&target, count, verts, c);
+}
+
+static cpSpaceDebugColor
+ColorForShape(cpShape *shape, cpDataPointer data) {
+  uint32_t val = (uint32_t)shape->hashid*2654435761u;
+  cpSpaceDebugColor color = {(val & 0xFF)/255.0f, ((val >> 8) & 0xFF)/255.0f, ((val >> 16) & 0xFF)/255.0f, 1.0f};
+  return color;
+}
+
+// Time frames of drawing every polygon of space, clearing in between.
+static uint64_t
+draw_frames(cpSpace *space, cpSpaceDebugDrawPolygonImpl polygon, int frames) {
+  cpSpaceDebugDrawOptions options = {
+    DrawNothingCircle,
+    DrawNothingSegment,
+    DrawNothingFatSegment,
+    polygon,
+    DrawNothingDot,
+
+    CP_SPACE_DEBUG_DRAW_SHAPES,
+
+    {1.0f, 1.0f, 1.0f, 1.0f},
+    ColorForShape,
+    {0.0f, 0.0f, 0.0f, 1.0f},
+    {0.0f, 0.0f, 0.0f, 1.0f},
+    NULL,
+  };
+
+  uint64_t total = 0;
+  for(int i=0; i<frames; i++) {
+    SDL_FillRect(surface, NULL, 0);
+    SDL_LockSurface(surface);
+    uint64_t t0 = step_now_ns();
+    cpSpaceDebugDraw(space, &options);
+    total += step_now_ns() - t0;
+    SDL_UnlockSurface(surface);
+  }
+  return total;
+}
+
+static void
+count_poly(cpShape *shape, int *count) {
+  if(shape->klass->type == CP_POLY_SHAPE) (*count)++;
+}
+
+static void
+usage(const char *prog) {
+  fprintf(stderr,
+    "usage: %s [-n frames] [-w settle] [-r rows] [-b bits]\n"
+    "  -n frames   frames drawn per renderer (default 500)\n"
+    "  -w settle   steps before drawing so the pyramid settles (default 200)\n"
+    "  -r rows     pyramid height (default 12)\n"
+    "  -b bits     surface depth, 16, 24 or 32 (default 24, like the demo)\n",
+    prog);
+}
+
+int main(int argc, char **argv) {
+  int frames = 500;
+  int settle = 200;
+  int bits   = 24;
+
+  space_params params;
+  space_params_default(&params);
+
+  int opt;
+  while((opt = getopt(argc, argv, "n:w:r:b:h")) != -1) {
+    switch(opt) {
+      case 'n': frames                    = atoi(optarg); break;
+      case 'w': settle                    = atoi(optarg); break;
+      case 'r': params.scene.pyramid_rows = atoi(optarg); break;
+      case 'b': bits                      = atoi(optarg); break;
+      default : usage(argv[0]); return opt == 'h' ? 0 : 1;
+    }
+  }
+  if(frames <= 0 || settle < 0 || (bits != 16 && bits != 24 && bits != 32)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  int width, height;
+  scene_extent(&params.scene, &width, &height);
+  width  = cpfmax(width, SCREEN_W);
+  height = cpfmax(height, SCREEN_H);
+
+  cpSpace *space = space_new(width, height, &params);
+  if(space == NULL) {
+    fprintf(stderr, "can't build the world\n");
+    return 1;
+  }
+  for(int i=0; i<settle; i++) space_update(space, 0.02);
+
+  Uint32 rmask = bits == 16 ? 0xF800 : 0xFF0000;
+  Uint32 gmask = bits == 16 ? 0x07E0 : 0x00FF00;
+  Uint32 bmask = bits == 16 ? 0x001F : 0x0000FF;
+  surface = SDL_CreateRGBSurface(SDL_SWSURFACE, width, height, bits, rmask, gmask, bmask, 0);
+  if(surface == NULL) {
+    fprintf(stderr, "can't create surface: %s\n", SDL_GetError());
+    return 1;
+  }
+  raster_target_init(&target, surface->pixels, surface->w, surface->h, surface->pitch, surface->format->BytesPerPixel);
+
+  int polys = 0;
+  cpSpaceEachShape(space, (cpSpaceShapeIteratorFunc)count_poly, &polys);
+
+  uint64_t gfx    = draw_frames(space, DrawPolygonGfx, frames);
+  uint64_t raster = draw_frames(space, DrawPolygonRaster, frames);
+
+  printf("surface           %dx%d, %d bit\n", width, height, bits);
+  printf("polygons          %d\n", polys);
+  printf("frames            %d\n", frames);
+  printf("SDL_gfx           %.1f us/frame  %.1f ns/poly\n", gfx/1e3/frames, (double)gfx/frames/polys);
+  printf("raster            %.1f us/frame  %.1f ns/poly\n", raster/1e3/frames, (double)raster/frames/polys);
+  printf("speedup           %.2fx\n", (double)gfx/raster);
+
+  SDL_FreeSurface(surface);
+  space_destroy(space);
+  return 0;
+}
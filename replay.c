@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "replay.h"
+
+#define REPLAY_MAGIC   0x706c7072u // "rplp"
+#define REPLAY_VERSION 5
+
+// On disk: this header, the events, then the level's chain counts and
+// vertexes if it has one. Raw structs, so logs only move between builds of
+// the same architecture, same as the bit-exact replay.
+typedef struct replay_header {
+  uint32_t     magic, version;
+  int32_t      width, height;
+  double       dt;
+  uint32_t     steps, events;
+  int32_t      level, level_width, level_height;
+  int32_t      num_chains, num_verts;
+  double       level_radius;
+  space_params params;
+} replay_header;
+
+replay_log *
+replay_new(int width, int height, double dt, const space_params *params) {
+  replay_log *log = calloc(1, sizeof(replay_log));
+  if(log == NULL) return NULL;
+
+  log->width  = width;
+  log->height = height;
+  log->dt     = dt;
+  if(params) {
+    log->params = *params;
+  } else {
+    space_params_default(&log->params);
+  }
+  // Params are written out raw; a path pointer means nothing in a file, and
+  // the cache doesn't change the world anyway.
+  log->params.scene.decomp_cache = NULL;
+  return log;
+}
+
+void
+replay_free(replay_log *log) {
+  if(log == NULL) return;
+  level_free(log->lvl);
+  free(log->events);
+  free(log);
+}
+
+int
+replay_set_level(replay_log *log, const level *lvl, cpFloat radius) {
+  level *copy = level_new(lvl->width, lvl->height, lvl->num_chains, lvl->num_verts);
+  if(copy == NULL) return 0;
+
+  memcpy(copy->chain_counts, lvl->chain_counts, sizeof(int)*lvl->num_chains);
+  memcpy(copy->verts, lvl->verts, sizeof(cpVect)*lvl->num_verts);
+  level_free(log->lvl);
+  log->lvl          = copy;
+  log->level_radius = radius;
+  return 1;
+}
+
+void
+replay_push(replay_log *log, uint32_t step, replay_event_type type, int x, int y) {
+  if(log->num == log->max) {
+    int max = log->max ? log->max*2 : 1024;
+    replay_event *events = realloc(log->events, sizeof(replay_event)*max);
+    if(events == NULL) return;
+    log->events = events;
+    log->max = max;
+  }
+
+  replay_event *evt = &log->events[log->num++];
+  evt->step = step;
+  evt->type = type;
+  evt->x    = x;
+  evt->y    = y;
+
+  if(step > log->steps) log->steps = step;
+}
+
+int
+replay_save(const replay_log *log, const char *path) {
+  FILE *f = fopen(path, "wb");
+  if(f == NULL) return 0;
+
+  replay_header header;
+  memset(&header, 0, sizeof(header));
+  header.magic   = REPLAY_MAGIC;
+  header.version = REPLAY_VERSION;
+  header.width   = log->width;
+  header.height  = log->height;
+  header.dt      = log->dt;
+  header.steps   = log->steps;
+  header.events  = log->num;
+  header.params  = log->params;
+  if(log->lvl) {
+    header.level        = 1;
+    header.level_width  = log->lvl->width;
+    header.level_height = log->lvl->height;
+    header.num_chains   = log->lvl->num_chains;
+    header.num_verts    = log->lvl->num_verts;
+    header.level_radius = log->level_radius;
+  }
+
+  int ok =
+    fwrite(&header, sizeof(header), 1, f) == 1 &&
+    fwrite(log->events, sizeof(replay_event), log->num, f) == (size_t)log->num;
+  if(ok && log->lvl) {
+    ok =
+      fwrite(log->lvl->chain_counts, sizeof(int), log->lvl->num_chains, f) == (size_t)log->lvl->num_chains &&
+      fwrite(log->lvl->verts, sizeof(cpVect), log->lvl->num_verts, f) == (size_t)log->lvl->num_verts;
+  }
+  return fclose(f) == 0 && ok;
+}
+
+replay_log *
+replay_load(const char *path) {
+  FILE *f = fopen(path, "rb");
+  if(f == NULL) return NULL;
+
+  replay_header header;
+  if(fread(&header, sizeof(header), 1, f) != 1 || header.magic != REPLAY_MAGIC || header.version != REPLAY_VERSION) {
+    fclose(f);
+    return NULL;
+  }
+
+  replay_log *log = replay_new(header.width, header.height, header.dt, &header.params);
+  if(log == NULL) {
+    fclose(f);
+    return NULL;
+  }
+  log->steps  = header.steps;
+  log->events = malloc(sizeof(replay_event)*(header.events ? header.events : 1));
+  log->max    = header.events;
+  log->num    = log->events ? fread(log->events, sizeof(replay_event), header.events, f) : 0;
+
+  int ok = (uint32_t)log->num == header.events;
+  if(ok && header.level) {
+    ok = header.num_chains >= 0 && header.num_verts >= 0;
+    if(ok) log->lvl = level_new(header.level_width, header.level_height, header.num_chains, header.num_verts);
+    log->level_radius = header.level_radius;
+    ok =
+      log->lvl &&
+      fread(log->lvl->chain_counts, sizeof(int), header.num_chains, f) == (size_t)header.num_chains &&
+      fread(log->lvl->verts, sizeof(cpVect), header.num_verts, f) == (size_t)header.num_verts &&
+      level_valid(log->lvl);
+  }
+  fclose(f);
+
+  if(!ok) {
+    replay_free(log);
+    return NULL;
+  }
+  return log;
+}
+
+cpSpace *
+replay_space_new(const replay_log *log) {
+  cpSpace *space = space_new(log->width, log->height, &log->params);
+  if(space) replay_add_level(log, space);
+  return space;
+}
+
+void
+replay_add_level(const replay_log *log, cpSpace *space) {
+  if(log->lvl) level_add(log->lvl, space, log->level_radius);
+}
+
+void
+replay_apply(const replay_log *log, cpSpace *space, uint32_t step, int *cursor) {
+  while(*cursor < log->num && log->events[*cursor].step <= step) {
+    const replay_event *evt = &log->events[(*cursor)++];
+    switch(evt->type) {
+      case REPLAY_MOUSE_MOVE: space_mouse_move(space, evt->x, evt->y); break;
+      case REPLAY_MOUSE_DOWN: space_mouse_down(space);                 break;
+      case REPLAY_MOUSE_UP  : space_mouse_up  (space);                 break;
+    }
+  }
+}
+
+void
+replay_run(const replay_log *log, cpSpace *space) {
+  int cursor = 0;
+  for(uint32_t step=0; step<log->steps; step++) {
+    replay_apply(log, space, step, &cursor);
+    space_update(space, log->dt);
+  }
+  replay_apply(log, space, log->steps, &cursor);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "space.h"
+#include "level.h"
+
+// Input log of a session: every space_mouse_* call tagged with the index of
+// the step it happened before, plus everything needed to rebuild the world.
+// Replaying it through the same build gives the same simulation bit for bit.
+
+typedef enum replay_event_type {
+  REPLAY_MOUSE_MOVE,
+  REPLAY_MOUSE_DOWN,
+  REPLAY_MOUSE_UP,
+} replay_event_type;
+
+typedef struct replay_event {
+  uint32_t step;
+  uint16_t type;
+  int16_t  x, y;
+} replay_event;
+
+typedef struct replay_log {
+  int           width, height;
+  double        dt;
+  uint32_t      steps;   // session length in steps
+  space_params  params;
+
+  // Level added on top of the scene, NULL if none. The chains themselves
+  // are logged, so a replay doesn't need the image it was compiled from.
+  level        *lvl;
+  cpFloat       level_radius;
+
+  replay_event *events;
+  int           num, max;
+} replay_log;
+
+replay_log * replay_new (int width, int height, double dt, const space_params *params);
+void         replay_free(replay_log *log);
+
+// Log the level added to the recorded world with level_add. Returns 0 when
+// out of memory.
+int          replay_set_level(replay_log *log, const level *lvl, cpFloat radius);
+
+void         replay_push(replay_log *log, uint32_t step, replay_event_type type, int x, int y);
+
+int          replay_save(const replay_log *log, const char *path);
+replay_log * replay_load(const char *path);
+
+// Build the recorded world, level included.
+cpSpace *    replay_space_new(const replay_log *log);
+
+// Add the logged level, if any, to space.
+void         replay_add_level(const replay_log *log, cpSpace *space);
+
+// Feed the events recorded before step to the space. cursor walks the event
+// list and starts at 0.
+void         replay_apply(const replay_log *log, cpSpace *space, uint32_t step, int *cursor);
+
+// Run a whole session headless.
+void         replay_run(const replay_log *log, cpSpace *space);
@@ -0,0 +1,331 @@
+#include "space.h"
+#include "decomp.h"
+
+#define BOX_W        20.0f
+#define BOX_H        (20.0f*1.618f)
+#define BOX_PITCH_X  32.0f
+#define BOX_PITCH_Y  40.0f
+#define BALL_RADIUS  15.0f
+#define RAIN_PITCH   40.0f
+
+// Concave rain outlines, about RAIN_PITCH across, and the hulls a typical
+// one decomposes into.
+#define CONCAVE_SHAPES    3
+#define CONCAVE_HULLS     3
+#define CONCAVE_TOLERANCE 0.5f
+
+static const cpVect concave_l[] = {
+  {-12,-12}, {-4,-12}, {-4,4}, {12,4}, {12,12}, {-12,12},
+};
+static const cpVect concave_u[] = {
+  {-14,-10}, {-8,-10}, {-8,4}, {8,4}, {8,-10}, {14,-10}, {14,10}, {-14,10},
+};
+static const cpVect concave_star[] = {
+  {0,-15}, {4,-5}, {14,-5}, {6,2}, {9,13}, {0,6}, {-9,13}, {-6,2}, {-14,-5}, {-4,-5},
+};
+
+// xorshift32, good enough to scatter shapes and fully reproducible.
+static cpFloat
+rand_unit(unsigned *state) {
+  unsigned x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return (x >> 8)*(1.0/16777216.0);
+}
+
+static cpFloat
+rand_range(unsigned *state, cpFloat min, cpFloat max) {
+  return min + (max - min)*rand_unit(state);
+}
+
+void
+scene_params_default(scene_params *params) {
+  params->pyramid_rows = 12;
+  params->stack_cols   = 0;
+  params->stack_height = 0;
+  params->rain_circles = 0;
+  params->rain_polys   = 0;
+  params->rain_concave = 0;
+  params->ball         = 1;
+  params->box_density  = 1.0f/(BOX_W*BOX_H);
+  params->rain_density = 1.0f/(BOX_W*BOX_H);
+  params->ball_density = 10.0f/cpAreaForCircle(0.0f, BALL_RADIUS);
+  params->seed         = 1;
+  params->decomp_cache = NULL;
+}
+
+void
+scene_params_for_bodies(scene_params *params, int bodies) {
+  scene_params_default(params);
+
+  // A quarter in the pyramid, half in stacks of 20, the rest as rain.
+  int rows = 0;
+  while((rows + 1)*(rows + 2)/2 <= bodies/4) rows++;
+  params->pyramid_rows = rows;
+  params->stack_height = 20;
+  params->stack_cols   = bodies/2/params->stack_height;
+
+  int rain = bodies - scene_body_count(params);
+  if(rain < 0) rain = 0;
+  params->rain_circles = rain/2;
+  params->rain_polys   = rain - rain/2;
+}
+
+int
+scene_body_count(const scene_params *params) {
+  return
+    params->pyramid_rows*(params->pyramid_rows + 1)/2 +
+    params->stack_cols*params->stack_height +
+    params->rain_circles + params->rain_polys + params->rain_concave +
+    (params->ball ? 1 : 0);
+}
+
+static int
+structure_width(const scene_params *params) {
+  return params->pyramid_rows*BOX_PITCH_X + params->stack_cols*BOX_PITCH_X;
+}
+
+static int
+rain_band(const scene_params *params, int width) {
+  int per_row = (int)(width/RAIN_PITCH) - 1;
+  int rain = params->rain_circles + params->rain_polys + params->rain_concave;
+  if(per_row < 1 || rain == 0) return 0;
+  return ((rain + per_row - 1)/per_row)*RAIN_PITCH;
+}
+
+void
+scene_extent(const scene_params *params, int *width, int *height) {
+  int w = structure_width(params) + 2*BOX_PITCH_X;
+  int tallest = cpfmax(params->pyramid_rows, params->stack_height)*BOX_PITCH_Y;
+  int h = tallest + rain_band(params, w) + 2*BOX_PITCH_Y;
+
+  // The walls reach from -height to height above the floor at y = height.
+  *width  = w;
+  *height = (h + 1)/2;
+}
+
+int
+scene_arena_init(scene_arena *store, const scene_params *params) {
+  size_t bodies = scene_body_count(params);
+
+  // Every shape fits in a cpPolyShape, the largest of the three kinds.
+  // Rain polygons have at most 6 verts so their planes stay inline. Concave
+  // bodies have a few hulls each; the arena grows if the guess falls short.
+  size_t shapes = bodies + 3 + params->rain_concave*(CONCAVE_HULLS - 1);
+  store->bodies = arena_new(bodies*sizeof(cpBody));
+  store->shapes = arena_new(shapes*sizeof(cpPolyShape));
+  return store->bodies && store->shapes;
+}
+
+void
+scene_arena_destroy(scene_arena *store) {
+  arena_free(store->bodies);
+  arena_free(store->shapes);
+  store->bodies = store->shapes = NULL;
+}
+
+// All of these return NULL when out of memory, arena or not.
+static cpBody *
+new_body(scene_arena *store, cpFloat mass, cpFloat moment) {
+  if(store == NULL) return cpBodyNew(mass, moment);
+
+  cpBody *body = arena_alloc(store->bodies, sizeof(cpBody));
+  return body ? cpBodyInit(body, mass, moment) : NULL;
+}
+
+static cpShape *
+new_segment(scene_arena *store, cpBody *body, cpVect a, cpVect b, cpFloat radius) {
+  if(store == NULL) return cpSegmentShapeNew(body, a, b, radius);
+
+  cpSegmentShape *shape = arena_alloc(store->shapes, sizeof(cpSegmentShape));
+  return shape ? (cpShape *)cpSegmentShapeInit(shape, body, a, b, radius) : NULL;
+}
+
+static cpShape *
+new_box(scene_arena *store, cpBody *body, cpFloat width, cpFloat height, cpFloat radius) {
+  if(store == NULL) return cpBoxShapeNew(body, width, height, radius);
+
+  cpPolyShape *shape = arena_alloc(store->shapes, sizeof(cpPolyShape));
+  return shape ? (cpShape *)cpBoxShapeInit(shape, body, width, height, radius) : NULL;
+}
+
+static cpShape *
+new_circle(scene_arena *store, cpBody *body, cpFloat radius) {
+  if(store == NULL) return cpCircleShapeNew(body, radius, cpvzero);
+
+  cpCircleShape *shape = arena_alloc(store->shapes, sizeof(cpCircleShape));
+  return shape ? (cpShape *)cpCircleShapeInit(shape, body, radius, cpvzero) : NULL;
+}
+
+static cpShape *
+new_poly(scene_arena *store, cpBody *body, int count, const cpVect *verts, cpFloat radius) {
+  if(store == NULL) return cpPolyShapeNew(body, count, verts, cpTransformIdentity, radius);
+
+  cpPolyShape *shape = arena_alloc(store->shapes, sizeof(cpPolyShape));
+  return shape ? (cpShape *)cpPolyShapeInit(shape, body, count, verts, cpTransformIdentity, radius) : NULL;
+}
+
+// The add_* functions return 0 when out of memory. Whatever was added to the
+// space by then stays there and goes with it.
+static int
+add_wall(cpSpace *space, scene_arena *store, cpVect a, cpVect b) {
+  cpShape *shape = new_segment(store, cpSpaceGetStaticBody(space), a, b, 0.0f);
+  if(shape == NULL) return 0;
+
+  space_add_static_shape(space, shape);
+  cpShapeSetElasticity(shape, 1.0f);
+  cpShapeSetFriction(shape, 1.0f);
+  cpShapeSetFilter(shape, NOT_GRABBABLE_FILTER);
+  return 1;
+}
+
+static int
+add_box(cpSpace *space, scene_arena *store, cpVect pos, cpFloat density) {
+  cpFloat mass = density*BOX_W*BOX_H;
+  cpBody *body = new_body(store, mass, cpMomentForBox(mass, BOX_W, BOX_H));
+  if(body == NULL) return 0;
+  cpSpaceAddBody(space, body);
+  cpBodySetPosition(body, pos);
+
+  cpShape *shape = new_box(store, body, BOX_W, BOX_H, 0.5f);
+  if(shape == NULL) return 0;
+  cpSpaceAddShape(space, shape);
+  cpShapeSetElasticity(shape, 0.0f);
+  cpShapeSetFriction(shape, 0.8f);
+  return 1;
+}
+
+static int
+add_circle(cpSpace *space, scene_arena *store, cpVect pos, cpFloat radius, cpFloat density, cpFloat friction) {
+  cpFloat mass = density*cpAreaForCircle(0.0f, radius);
+  cpBody *body = new_body(store, mass, cpMomentForCircle(mass, 0.0f, radius, cpvzero));
+  if(body == NULL) return 0;
+  cpSpaceAddBody(space, body);
+  cpBodySetPosition(body, pos);
+
+  cpShape *shape = new_circle(store, body, radius);
+  if(shape == NULL) return 0;
+  cpSpaceAddShape(space, shape);
+  cpShapeSetElasticity(shape, 0.0f);
+  cpShapeSetFriction(shape, friction);
+  return 1;
+}
+
+// Points on a circle at increasing angles always form a convex polygon.
+static int
+add_poly(cpSpace *space, scene_arena *store, cpVect pos, unsigned *rng, cpFloat density) {
+  int     count  = 3 + (int)(rand_unit(rng)*4.0f);
+  cpFloat radius = rand_range(rng, 6.0f, 16.0f);
+  cpVect  verts[6];
+  for(int i=0; i<count; i++) {
+    cpFloat a = (i + rand_range(rng, -0.3f, 0.3f))*2.0f*CP_PI/count;
+    verts[i] = cpvmult(cpvforangle(a), radius);
+  }
+
+  cpFloat mass = density*cpAreaForPoly(count, verts, 0.0f);
+  cpBody *body = new_body(store, mass, cpMomentForPoly(mass, count, verts, cpvzero, 0.0f));
+  if(body == NULL) return 0;
+  cpSpaceAddBody(space, body);
+  cpBodySetPosition(body, pos);
+
+  cpShape *shape = new_poly(store, body, count, verts, 0.5f);
+  if(shape == NULL) return 0;
+  cpSpaceAddShape(space, shape);
+  cpShapeSetElasticity(shape, 0.0f);
+  cpShapeSetFriction(shape, 0.8f);
+  return 1;
+}
+
+// Decompositions come from a cache shared by the whole build, so every copy
+// of an outline after the first costs a lookup.
+static int
+add_concave(cpSpace *space, scene_arena *store, cpVect pos, unsigned *rng, cpFloat density, decomp_cache *cache) {
+  const cpVect *outline;
+  int count;
+  switch((int)(rand_unit(rng)*CONCAVE_SHAPES)) {
+    case 0 : outline = concave_l; count = sizeof(concave_l)/sizeof(cpVect); break;
+    case 1 : outline = concave_u; count = sizeof(concave_u)/sizeof(cpVect); break;
+    default: outline = concave_star; count = sizeof(concave_star)/sizeof(cpVect); break;
+  }
+
+  const decomp *d = decomp_get(cache, outline, count, CONCAVE_TOLERANCE);
+  if(d == NULL) return 1;
+
+  cpBody *body = new_body(store, density*d->area, density*d->moment);
+  if(body == NULL) return 0;
+  cpSpaceAddBody(space, body);
+  cpBodySetPosition(body, pos);
+  cpBodySetAngle(body, rand_range(rng, 0.0f, 2.0f*CP_PI));
+
+  const cpVect *v = d->verts;
+  for(int i=0; i<d->num_hulls; i++) {
+    cpShape *shape = new_poly(store, body, d->hull_counts[i], v, 0.0f);
+    if(shape == NULL) return 0;
+    cpSpaceAddShape(space, shape);
+    cpShapeSetElasticity(shape, 0.0f);
+    cpShapeSetFriction(shape, 0.8f);
+    v += d->hull_counts[i];
+  }
+  return 1;
+}
+
+int
+scene_build(cpSpace *space, int width, int height, const scene_params *params, scene_arena *store) {
+
+  unsigned rng = params->seed ? params->seed : 1;
+
+  // Create segments around the edge of the screen.
+  int ok =
+    add_wall(space, store, cpv(0,-height), cpv(0,height)) &&
+    add_wall(space, store, cpv(width,-height), cpv(width,height)) &&
+    add_wall(space, store, cpv(0,height), cpv(width,height));
+
+  // Pyramid and stacks share the floor, centered together in the world.
+  cpFloat left  = width/2 - structure_width(params)/2;
+  cpFloat apex  = left + params->pyramid_rows*BOX_PITCH_X/2;
+  int     rows  = params->pyramid_rows;
+
+  for(int i=0; i<rows && ok; i++){
+    for(int j=0; j<=i && ok; j++){
+      ok = add_box(space, store, cpv(apex + j*BOX_PITCH_X - i*BOX_PITCH_X/2, height - (rows - i)*BOX_PITCH_Y), params->box_density);
+    }
+  }
+
+  cpFloat stacks = left + rows*BOX_PITCH_X + BOX_PITCH_X/2;
+  for(int i=0; i<params->stack_cols && ok; i++){
+    for(int j=0; j<params->stack_height && ok; j++){
+      ok = add_box(space, store, cpv(stacks + i*BOX_PITCH_X, height - (j + 1)*BOX_PITCH_Y), params->box_density);
+    }
+  }
+
+  // Rain fills rows above the tallest structure, one shape per cell with a
+  // little jitter so it doesn't settle as a lattice.
+  int     per_row = (int)(width/RAIN_PITCH) - 1;
+  int     rain    = params->rain_circles + params->rain_polys + params->rain_concave;
+  cpFloat top     = height - (cpfmax(rows, params->stack_height) + 1)*BOX_PITCH_Y;
+  decomp_cache *concave = params->rain_concave ? decomp_cache_new(params->decomp_cache) : NULL;
+  for(int i=0; i<rain && per_row > 0 && ok; i++){
+    cpVect pos = cpv(
+      (i%per_row + 1)*RAIN_PITCH + rand_range(&rng, -5.0f, 5.0f),
+      top - (i/per_row)*RAIN_PITCH + rand_range(&rng, -5.0f, 5.0f)
+    );
+
+    if(i < params->rain_circles){
+      ok = add_circle(space, store, pos, rand_range(&rng, 5.0f, 15.0f), params->rain_density, 0.8f);
+    } else if(i < params->rain_circles + params->rain_polys){
+      ok = add_poly(space, store, pos, &rng, params->rain_density);
+    } else {
+      ok = add_concave(space, store, pos, &rng, params->rain_density, concave);
+    }
+  }
+  if(concave && decomp_cache_dirty(concave)) decomp_cache_save(concave);
+  decomp_cache_free(concave);
+
+  // Add a ball to make things more interesting
+  if(params->ball && ok){
+    ok = add_circle(space, store, cpv(width/2.0, -height/2.0 + BALL_RADIUS+5), BALL_RADIUS, params->ball_density, 0.9f);
+  }
+  return ok;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <chipmunk/chipmunk.h>
+
+#include "arena.h"
+
+// Procedural scene description. Everything is laid out relative to the floor
+// at y = height; gravity points down the screen (+y). The same params and
+// seed always produce the same world.
+typedef struct scene_params {
+  int      pyramid_rows;  // box pyramid, rows*(rows+1)/2 boxes
+  int      stack_cols;    // grid of box stacks next to the pyramid
+  int      stack_height;  // boxes per stack
+  int      rain_circles;  // random circles dropped from above the scene
+  int      rain_polys;    // random convex polygons dropped from above
+  int      rain_concave;  // concave compound bodies dropped from above
+  int      ball;          // heavy ball dropped on the pyramid
+  cpFloat  box_density;
+  cpFloat  rain_density;
+  cpFloat  ball_density;
+  unsigned seed;
+
+  // File the concave decompositions are loaded from and saved back to, so
+  // later builds skip decomposing; NULL keeps them in memory for one build.
+  // Not for builds running concurrently.
+  const char *decomp_cache;
+} scene_params;
+
+// The demo scene: a 12 row pyramid and one ball.
+void scene_params_default(scene_params *params);
+
+// A mixed scene of roughly the given number of bodies: a pyramid, a grid of
+// stacks and a rain of circles and polygons.
+void scene_params_for_bodies(scene_params *params, int bodies);
+
+int  scene_body_count(const scene_params *params);
+
+// Smallest world size that holds the scene between the walls.
+void scene_extent(const scene_params *params, int *width, int *height);
+
+// Optional contiguous storage for the scene's objects: bodies and shapes are
+// initialized in place with cpBodyInit/cp*ShapeInit instead of cp*New, so the
+// solver walks bodies that sit next to each other in memory.
+typedef struct scene_arena {
+  arena *bodies;
+  arena *shapes;
+} scene_arena;
+
+// Size both arenas for the objects scene_build will create. Returns 0 when
+// out of memory; scene_arena_destroy still cleans up.
+int  scene_arena_init(scene_arena *store, const scene_params *params);
+void scene_arena_destroy(scene_arena *store);
+
+// Build the scene into space, allocating from store when it isn't NULL.
+// Returns 0 when out of memory, with part of the scene in space.
+int  scene_build(cpSpace *space, int width, int height, const scene_params *params, scene_arena *store);
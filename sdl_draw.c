@@ -1,4 +1,131 @@
 //SDL DRAW IMPLEMENTATION
+//
+// Included at the end of chipmunk_sdl.c and headless.c, which provide
+// screen and SCREEN_BG.
+
+static inline cpSpaceDebugColor RGBAColor(float r, float g, float b, float a){
+  cpSpaceDebugColor color = {r, g, b, a};
+  return color;
+}
+
+static inline cpSpaceDebugColor LAColor(float l, float a){
+  cpSpaceDebugColor color = {l, l, l, a};
+  return color;
+}
+
+#define SHAPE_OUTLINE ((cpSpaceDebugColor){200.0f/255.0f, 210.0f/255.0f, 230.0f/255.0f, 1.0f})
+
+// Dirty rectangles are made of DIRTY_TILE squares and frames are rasterized
+// in RASTER_TILE squares, a multiple of it, so one raster tile overlaps at
+// most REGION_MAX dirty rectangles.
+#define DIRTY_TILE  32
+#define RASTER_TILE 64
+#define REGION_MAX  ((RASTER_TILE/DIRTY_TILE)*(RASTER_TILE/DIRTY_TILE))
+
+// COMMAND BUFFER
+//
+// Nothing below draws while the space is being read. Shapes, constraints and
+// contacts are recorded as commands with their colors already packed and
+// their vertexes already transformed, and the list is executed later,
+// normally on the render thread while the next step runs.
+
+typedef enum draw_op {
+  OP_BLIT,     // copy rect from the static layer
+  OP_REGION,   // clip the commands that follow to the list's rects
+  OP_CIRCLE,   // filled circle at vertex first, radius r
+  OP_LINE,     // line from vertex first to first + 1
+  OP_DOT,      // circle outline at vertex first
+  OP_POLY,     // convex polygon of count vertexes from first
+} draw_op;
+
+typedef struct draw_cmd {
+  draw_op  op;
+  Uint32   color;   // pixel value in the screen format
+  int      first, count;
+  float    r;
+  SDL_Rect rect;
+} draw_cmd;
+
+typedef struct draw_list {
+  draw_cmd *cmds;
+  int       num_cmds, max_cmds;
+  cpVect   *verts;
+  int       num_verts, max_verts;
+  SDL_Rect *rects;  // screen areas to present once the list has run
+  int       num_rects;
+} draw_list;
+
+// List the draw functions below record into.
+static draw_list *recording = NULL;
+
+// Background the dirty rectangles are blitted from, see STATIC LAYER.
+static SDL_Surface *static_layer = NULL;
+
+static void
+ResetList(draw_list *list) {
+  list->num_cmds  = 0;
+  list->num_verts = 0;
+  list->num_rects = 0;
+}
+
+static draw_cmd *
+PushCommand(draw_op op, Uint32 color, int count) {
+  draw_list *list = recording;
+  if(list->num_cmds == list->max_cmds) {
+    list->max_cmds = list->max_cmds ? list->max_cmds*2 : 256;
+    list->cmds = realloc(list->cmds, sizeof(draw_cmd)*list->max_cmds);
+  }
+  if(list->num_verts + count > list->max_verts) {
+    list->max_verts = (list->num_verts + count)*2;
+    list->verts = realloc(list->verts, sizeof(cpVect)*list->max_verts);
+  }
+
+  draw_cmd *cmd = &list->cmds[list->num_cmds++];
+  cmd->op    = op;
+  cmd->color = color;
+  cmd->first = list->num_verts;
+  cmd->count = count;
+  list->num_verts += count;
+  return cmd;
+}
+
+static inline cpVect *
+CommandVerts(draw_cmd *cmd) {
+  return recording->verts + cmd->first;
+}
+
+static inline Uint32
+MapColor(cpSpaceDebugColor color) {
+  return SDL_MapRGB(screen->format, color.r*255, color.g*255, color.b*255);
+}
+
+// Segments are drawn as white hairlines whatever their color.
+static Uint32 line_pixel;
+
+static void
+RecordCircle(cpVect p, cpFloat r, Uint32 c) {
+  draw_cmd *cmd = PushCommand(OP_CIRCLE, c, 1);
+  cmd->r = r;
+  CommandVerts(cmd)[0] = p;
+}
+
+static void
+RecordLine(cpVect a, cpVect b, Uint32 c) {
+  draw_cmd *cmd = PushCommand(OP_LINE, c, 2);
+  CommandVerts(cmd)[0] = a;
+  CommandVerts(cmd)[1] = b;
+}
+
+static void
+RecordPolygon(int count, const cpVect *verts, Uint32 pixel) {
+  draw_cmd *cmd = PushCommand(OP_POLY, pixel, count);
+  memcpy(CommandVerts(cmd), verts, sizeof(cpVect)*count);
+}
+
+static void
+RecordRect(draw_op op, SDL_Rect rect) {
+  PushCommand(op, 0, 0)->rect = rect;
+}
 
 static void
 DrawCircle(
@@ -9,14 +136,7 @@ DrawCircle(
   cpSpaceDebugColor fill, 
   cpDataPointer     data) {
 
-  uint c = 
-    ((uint)(fill.r * 255)<<24)|
-    ((uint)(fill.g * 255)<<16)|
-    ((uint)(fill.b * 255)<< 8)|0xFF;
-
-  filledCircleColor(screen, p.x, p.y, r, c);  
-  // circleColor(screen, p.x, p.y, r, c);  
-  // printf("ChipmunkDebugDrawCircle(p, a, r, outline, fill)\n");
+  RecordCircle(p, r, MapColor(fill));
 }
 
 static void
@@ -26,14 +146,7 @@ DrawSegment(
   cpSpaceDebugColor color, 
   cpDataPointer     data) {
 
-  uint c = 
-    ((uint)(color.r*255)<<24)|
-    ((uint)(color.g*255)<<16)|
-    ((uint)(color.b*255)<< 8)|0xFF;
-
-  lineColor(screen, a.x, a.y, b.x, b.y, c);
-
-  // printf("ChipmunkDebugDrawSegment(a, b, color)\n");
+  RecordLine(a, b, MapColor(color));
 }
 
 static void
@@ -45,9 +158,7 @@ DrawFatSegment(
   cpSpaceDebugColor fill, 
   cpDataPointer     data) {
   
-  lineColor(screen, a.x, a.y, b.x, b.y, 0xFFFFFFFF);
-
-  // printf("ChipmunkDebugDrawFatSegment(a, b, r, outline, fill)\n");
+  RecordLine(a, b, line_pixel);
 }
 
 static void
@@ -58,18 +169,8 @@ DrawPolygon(
   cpSpaceDebugColor outline, 
   cpSpaceDebugColor fill, 
   cpDataPointer     data){ 
-  uint c = 
-    ((uint)(fill.r*255)<<24)|
-    ((uint)(fill.g*255)<<16)|
-    ((uint)(fill.b*255)<< 8)|0xFF;
 
-  Sint16 vx[count], vy[count];
-  for(int i=0; i<count; i++) {
-    vx[i] = verts[i].x;
-    vy[i] = verts[i].y;
-  }
-  filledPolygonColor(screen, vx, vy, count, c);
-  // polygonColor(screen, vx, vy, count, c);
+  RecordPolygon(count, verts, MapColor(fill));
 }
 
 static void
@@ -79,16 +180,8 @@ DrawDot(
   cpSpaceDebugColor color, 
   cpDataPointer data){
 
-  uint c = 
-    ((uint)(color.r*255)<<24)|
-    ((uint)(color.g*255)<<16)|
-    ((uint)(color.b*255)<< 8)|0xFF;
-
-  // lineColor(screen, pos.x     , pos.y-size, pos.x     , pos.y+size, c);
-  // lineColor(screen, pos.x-size, pos.y     , pos.x+size, pos.y     , c);
-  circleColor(screen, p.x, p.y, 5, c);  
-
-  // printf("ChipmunkDebugDrawDot(size, pos, color)\n");
+  draw_cmd *cmd = PushCommand(OP_DOT, MapColor(color), 1);
+  CommandVerts(cmd)[0] = p;
 }
 
 
@@ -138,24 +231,691 @@ ColorForShape(cpShape *shape, cpDataPointer data) {
   }
 }
 
+// SHAPE STATE
+//
+// What the renderer remembers about each shape between frames, in a flat
+// table indexed by hashid: where it was drawn for the dirty rectangles, and
+// its fill color mapped to the screen format. The
+// color only changes with the sleep state, so ColorForShape runs again only
+// when the body falls asleep, idles past the sleep threshold or wakes up.
+
+typedef enum shape_look {
+  LOOK_NONE,      // color not computed yet
+  LOOK_AWAKE,
+  LOOK_IDLE,
+  LOOK_SLEEPING,
+  LOOK_SENSOR,
+} shape_look;
+
+typedef struct shape_state {
+  SDL_Rect rect;      // screen area of the shape when it was last drawn
+  Uint8    drawn;
+  Uint8    sleeping;
+
+  Uint8    look;      // shape_look pixel is for
+  Uint32   pixel;     // fill, from SDL_MapRGB
+} shape_state;
+
+static shape_state *shape_states     = NULL;
+static int          num_shape_states = 0;
+
+static shape_state *
+StateForShape(cpShape *shape) {
+  int i = (int)shape->hashid;
+  if(i >= num_shape_states) {
+    int num = (i + 1)*2;
+    shape_states = realloc(shape_states, sizeof(shape_state)*num);
+    memset(shape_states + num_shape_states, 0, sizeof(shape_state)*(num - num_shape_states));
+    num_shape_states = num;
+  }
+  return &shape_states[i];
+}
+
+static shape_look
+LookForShape(cpShape *shape) {
+  cpBody *body = shape->body;
+  if(cpShapeGetSensor(shape))                                     return LOOK_SENSOR;
+  if(cpBodyIsSleeping(body))                                      return LOOK_SLEEPING;
+  if(body->sleeping.idleTime > shape->space->sleepTimeThreshold) return LOOK_IDLE;
+  return LOOK_AWAKE;
+}
+
+// Cached color of shape, recomputed when its look changed.
+static shape_state *
+ColorsForShape(cpShape *shape) {
+  shape_state *state = StateForShape(shape);
+  shape_look   look  = LookForShape(shape);
+  if(state->look != look) {
+    state->look  = look;
+    state->pixel = MapColor(ColorForShape(shape, NULL));
+  }
+  return state;
+}
+
+// Shapes are drawn one at a time so only those overlapping a dirty
+// rectangle are drawn; this mirrors what cpSpaceDebugDraw does per shape and
+// the Draw* functions above do with its colors, using the cached ones.
+static void
+DrawShape(cpShape *shape, cpDataPointer data) {
+  shape_state *colors = ColorsForShape(shape);
+
+  switch(shape->klass->type) {
+    case CP_CIRCLE_SHAPE: {
+      cpCircleShape *circle = (cpCircleShape *)shape;
+      RecordCircle(circle->tc, circle->r, colors->pixel);
+      break;
+    }
+    case CP_SEGMENT_SHAPE: {
+      cpSegmentShape *seg = (cpSegmentShape *)shape;
+      RecordLine(seg->ta, seg->tb, line_pixel);
+      break;
+    }
+    case CP_POLY_SHAPE: {
+      cpPolyShape *poly = (cpPolyShape *)shape;
+      draw_cmd *cmd = PushCommand(OP_POLY, colors->pixel, poly->count);
+      cpVect *verts = CommandVerts(cmd);
+      for(int i=0; i<poly->count; i++) verts[i] = poly->planes[i].v0;
+      break;
+    }
+    default: break;
+  }
+}
+
+// EXECUTION
+//
+// A list runs tile by tile across the pool's threads. Every drawing command
+// is binned into the RASTER_TILE sized tiles its bounds touch, in list
+// order, and each tile then rasterizes its own commands with raster.c clipped
+// to the tile, so threads never write the same pixels and overlapping shapes
+// still land in list order.
+
+typedef struct tile_bins {
+  const draw_list *list;
+  SDL_Surface     *surface;
+  int              tiles_w, tiles_h;
+  int             *start;     // per tile, into cmds; one extra at the end
+  int              max_tiles;
+  int             *cmds;      // command indexes of each tile back to back
+  int              max_cmds;
+  int             *clip;      // per command, its OP_REGION or -1
+  SDL_Rect        *tiles;     // per command, the tile range it covers
+  int              max_list;
+} tile_bins;
+
+static tile_bins bins;
+static pool     *raster_pool = NULL;
+
+// Tiles touched by cmd within clip, as x, y, w, h in tiles; w is 0 when none.
+static SDL_Rect
+TilesForCommand(const draw_list *list, const draw_cmd *cmd, SDL_Rect clip) {
+  const cpVect *v = list->verts + cmd->first;
+  double l, t, r, b;
+  switch(cmd->op) {
+    case OP_CIRCLE:
+      l = v[0].x - cmd->r; r = v[0].x + cmd->r;
+      t = v[0].y - cmd->r; b = v[0].y + cmd->r;
+      break;
+    case OP_DOT:
+      l = v[0].x - 6; r = v[0].x + 6;
+      t = v[0].y - 6; b = v[0].y + 6;
+      break;
+    default:
+      l = r = v[0].x;
+      t = b = v[0].y;
+      for(int i=1; i<cmd->count; i++) {
+        l = fmin(l, v[i].x); r = fmax(r, v[i].x);
+        t = fmin(t, v[i].y); b = fmax(b, v[i].y);
+      }
+  }
+
+  int x0 = fmax(floor(l) - 1, clip.x), x1 = fmin(ceil(r) + 1, clip.x + clip.w);
+  int y0 = fmax(floor(t) - 1, clip.y), y1 = fmin(ceil(b) + 1, clip.y + clip.h);
+  SDL_Rect tiles = {0, 0, 0, 0};
+  if(x0 < x1 && y0 < y1) {
+    tiles.x = x0/RASTER_TILE;
+    tiles.y = y0/RASTER_TILE;
+    tiles.w = (x1 - 1)/RASTER_TILE - tiles.x + 1;
+    tiles.h = (y1 - 1)/RASTER_TILE - tiles.y + 1;
+  }
+  return tiles;
+}
+
+static int
+IntersectRect(SDL_Rect a, SDL_Rect b, SDL_Rect *out) {
+  int x0 = cpfmax(a.x, b.x), x1 = cpfmin(a.x + a.w, b.x + b.w);
+  int y0 = cpfmax(a.y, b.y), y1 = cpfmin(a.y + a.h, b.y + b.h);
+  if(x0 >= x1 || y0 >= y1) return 0;
+
+  out->x = x0;
+  out->y = y0;
+  out->w = x1 - x0;
+  out->h = y1 - y0;
+  return 1;
+}
+
+// Bounding box of the list's rects. Commands in the region are binned by
+// it; RasterTile clips them to the rects themselves.
+static SDL_Rect
+RegionBounds(const draw_list *list) {
+  SDL_Rect bounds = {0, 0, 0, 0};
+  if(list->num_rects == 0) return bounds;
+
+  const SDL_Rect *first = &list->rects[0];
+  int x0 = first->x, y0 = first->y, x1 = first->x + first->w, y1 = first->y + first->h;
+  for(int i=1; i<list->num_rects; i++) {
+    const SDL_Rect *r = &list->rects[i];
+    x0 = cpfmin(x0, r->x);
+    y0 = cpfmin(y0, r->y);
+    x1 = cpfmax(x1, r->x + r->w);
+    y1 = cpfmax(y1, r->y + r->h);
+  }
+  bounds.x = x0;
+  bounds.y = y0;
+  bounds.w = x1 - x0;
+  bounds.h = y1 - y0;
+  return bounds;
+}
+
+static void
+BinCommands(const draw_list *list, SDL_Surface *surface) {
+  bins.list    = list;
+  bins.surface = surface;
+  bins.tiles_w = (surface->w + RASTER_TILE - 1)/RASTER_TILE;
+  bins.tiles_h = (surface->h + RASTER_TILE - 1)/RASTER_TILE;
+
+  int num_tiles = bins.tiles_w*bins.tiles_h;
+  if(num_tiles + 1 > bins.max_tiles) {
+    bins.max_tiles = num_tiles + 1;
+    bins.start = realloc(bins.start, sizeof(int)*bins.max_tiles);
+  }
+  if(list->num_cmds > bins.max_list) {
+    bins.max_list = list->num_cmds*2;
+    bins.clip  = realloc(bins.clip, sizeof(int)*bins.max_list);
+    bins.tiles = realloc(bins.tiles, sizeof(SDL_Rect)*bins.max_list);
+  }
+
+  // Count per tile, then turn the counts into offsets and fill in order.
+  memset(bins.start, 0, sizeof(int)*(num_tiles + 1));
+  SDL_Rect full = {0, 0, surface->w, surface->h}, clip = full;
+  int clip_cmd = -1, total = 0;
+  for(int i=0; i<list->num_cmds; i++) {
+    const draw_cmd *cmd = &list->cmds[i];
+    SDL_Rect *tiles = &bins.tiles[i];
+    tiles->w = 0;
+    bins.clip[i] = clip_cmd;
+
+    if(cmd->op == OP_BLIT) continue;
+    if(cmd->op == OP_REGION) {
+      clip     = RegionBounds(list);
+      clip_cmd = i;
+      continue;
+    }
+
+    *tiles = TilesForCommand(list, cmd, clip);
+    for(int ty=tiles->y; ty<tiles->y + tiles->h; ty++) {
+      for(int tx=tiles->x; tx<tiles->x + tiles->w; tx++) bins.start[ty*bins.tiles_w + tx + 1]++;
+    }
+    total += tiles->w*tiles->h;
+  }
+  for(int i=0; i<num_tiles; i++) bins.start[i + 1] += bins.start[i];
+
+  if(total > bins.max_cmds) {
+    bins.max_cmds = total*2;
+    bins.cmds = realloc(bins.cmds, sizeof(int)*bins.max_cmds);
+  }
+
+  // start[tile] moves up as the tile fills and ends at the next tile's
+  // offset; shifting it back afterwards restores the offsets.
+  for(int i=0; i<list->num_cmds; i++) {
+    SDL_Rect *tiles = &bins.tiles[i];
+    for(int ty=tiles->y; ty<tiles->y + tiles->h; ty++) {
+      for(int tx=tiles->x; tx<tiles->x + tiles->w; tx++) bins.cmds[bins.start[ty*bins.tiles_w + tx]++] = i;
+    }
+  }
+  memmove(bins.start + 1, bins.start, sizeof(int)*num_tiles);
+  bins.start[0] = 0;
+}
+
+static void
+RasterTile(void *data, int index, int worker) {
+  const draw_list *list    = bins.list;
+  SDL_Surface     *surface = bins.surface;
+
+  int tx0 = (index%bins.tiles_w)*RASTER_TILE, ty0 = (index/bins.tiles_w)*RASTER_TILE;
+  int tx1 = cpfmin(tx0 + RASTER_TILE, surface->w), ty1 = cpfmin(ty0 + RASTER_TILE, surface->h);
+
+  raster_target target;
+  raster_target_init(&target, surface->pixels, surface->w, surface->h, surface->pitch, surface->format->BytesPerPixel);
+
+  // Parts of the tile the current commands may draw into: the tile itself,
+  // or where it overlaps the list's rects.
+  SDL_Rect tile = {tx0, ty0, tx1 - tx0, ty1 - ty0};
+  SDL_Rect clips[REGION_MAX];
+  int num_clips = 0, clip = -2;
+
+  for(int i=bins.start[index]; i<bins.start[index + 1]; i++) {
+    int             c   = bins.cmds[i];
+    const draw_cmd *cmd = &list->cmds[c];
+    const cpVect   *v   = list->verts + cmd->first;
+
+    if(bins.clip[c] != clip) {
+      clip = bins.clip[c];
+      num_clips = 0;
+      if(clip < 0) {
+        clips[num_clips++] = tile;
+      } else {
+        for(int j=0; j<list->num_rects && num_clips<REGION_MAX; j++) {
+          if(IntersectRect(tile, list->rects[j], &clips[num_clips])) num_clips++;
+        }
+      }
+    }
+
+    for(int j=0; j<num_clips; j++) {
+      target.x0 = clips[j].x;
+      target.y0 = clips[j].y;
+      target.x1 = clips[j].x + clips[j].w;
+      target.y1 = clips[j].y + clips[j].h;
+
+      switch(cmd->op) {
+        case OP_CIRCLE: raster_fill_circle(&target, v[0], cmd->r, cmd->color); break;
+        case OP_LINE  : raster_line(&target, v[0], v[1], cmd->color); break;
+        case OP_DOT   : raster_circle(&target, v[0], 5, cmd->color); break;
+        case OP_POLY  : raster_fill_convex(&target, cmd->count, v, cmd->color); break;
+        default: break;
+      }
+    }
+  }
+}
+
+static void
+ExecuteList(const draw_list *list, SDL_Surface *surface) {
+  // Blits can't run on a locked surface, so they all go first; together they
+  // cover the region the drawing commands are clipped to.
+  for(int i=0; i<list->num_cmds; i++) {
+    const draw_cmd *cmd = &list->cmds[i];
+    if(cmd->op == OP_BLIT) {
+      SDL_Rect rect = cmd->rect;
+      SDL_BlitSurface(static_layer, &rect, surface, &rect);
+    }
+  }
+
+  BinCommands(list, surface);
+
+  SDL_LockSurface(surface);
+  int tiles = bins.tiles_w*bins.tiles_h;
+  if(raster_pool) {
+    pool_run(raster_pool, tiles, RasterTile, NULL);
+  } else {
+    for(int i=0; i<tiles; i++) RasterTile(NULL, i, 0);
+  }
+  SDL_UnlockSurface(surface);
+}
+
+// RENDER THREAD
+//
+// Two lists: the main thread records one while the render thread executes
+// the other into the screen, with the pool's threads. RenderSubmit waits for
+// the list in flight, presents it and hands over the one just recorded, so
+// drawing frame N overlaps stepping towards frame N + 1 at the cost of one
+// frame of latency. Only the main thread talks to the display.
+
+static draw_list   lists[2];
+static int         writing = 0;
+
+static SDL_Thread *render_thread = NULL;
+static SDL_mutex  *render_lock;
+static SDL_cond   *render_cond;
+static draw_list  *render_list = NULL;  // in flight, NULL when idle
+static int         render_quit = 0;
+
+static int
+RenderThread(void *data) {
+  SDL_LockMutex(render_lock);
+  while(1) {
+    while(render_list == NULL && !render_quit) SDL_CondWait(render_cond, render_lock);
+    if(render_list == NULL) break;
+
+    draw_list *list = render_list;
+    SDL_UnlockMutex(render_lock);
+    ExecuteList(list, screen);
+    SDL_LockMutex(render_lock);
+
+    render_list = NULL;
+    SDL_CondBroadcast(render_cond);
+  }
+  SDL_UnlockMutex(render_lock);
+  return 0;
+}
+
+// threads is the size of the raster pool, counting the render thread. 0
+// leaves one CPU to the main thread, which keeps stepping while frames are
+// rasterized.
+static void
+RenderStart(int threads) {
+  if(threads <= 0) threads = cpfmax((int)sysconf(_SC_NPROCESSORS_ONLN) - 1, 1);
+
+  line_pixel  = SDL_MapRGB(screen->format, 0xFF, 0xFF, 0xFF);
+  raster_pool = pool_new(threads);
+  if(raster_pool == NULL) fprintf(stderr, "can't start %d raster threads, rasterizing on the render thread\n", threads);
+
+  render_lock   = SDL_CreateMutex();
+  render_cond   = SDL_CreateCond();
+  render_thread = SDL_CreateThread(RenderThread, NULL);
+  if(render_thread == NULL) {
+    fprintf(stderr, "can't start render thread: %s\n", SDL_GetError());
+    exit(1);
+  }
+}
+
+// Block until the render thread is idle.
+static void
+RenderWait(void) {
+  SDL_LockMutex(render_lock);
+  while(render_list != NULL) SDL_CondWait(render_cond, render_lock);
+  SDL_UnlockMutex(render_lock);
+}
+
+static void
+RenderSubmit(void) {
+  RenderWait();
+
+  draw_list *done = &lists[writing ^ 1];
+  if(done->num_rects > 0) SDL_UpdateRects(screen, done->num_rects, done->rects);
+  done->num_rects = 0;
+
+  draw_list *next = &lists[writing];
+  if(next->num_rects == 0) return;
+
+  SDL_LockMutex(render_lock);
+  render_list = next;
+  SDL_CondBroadcast(render_cond);
+  SDL_UnlockMutex(render_lock);
+  writing ^= 1;
+}
+
+static void
+RenderStop(void) {
+  RenderWait();
+
+  SDL_LockMutex(render_lock);
+  render_quit = 1;
+  SDL_CondBroadcast(render_cond);
+  SDL_UnlockMutex(render_lock);
+  SDL_WaitThread(render_thread, NULL);
+
+  SDL_DestroyCond(render_cond);
+  SDL_DestroyMutex(render_lock);
+  pool_free(raster_pool);
+  for(int i=0; i<2; i++) {
+    free(lists[i].cmds);
+    free(lists[i].verts);
+    free(lists[i].rects);
+  }
+}
+
+// STATIC LAYER
+//
+// Static shapes are drawn once over the background into a surface of the
+// screen's format, which then stands in for the background: redrawing a
+// rectangle starts by copying it from the layer. The layer is redrawn only
+// when space_static_version changes.
+
+static uint32_t     static_layer_version;
+static draw_list    static_list;
+
 static void
-DrawImpl(cpSpace *space) {
+DrawStaticShape(cpShape *shape, cpDataPointer data) {
+  if(cpBodyGetType(shape->body) == CP_BODY_TYPE_STATIC) DrawShape(shape, data);
+}
+
+// Returns 1 when the layer was redrawn and the whole screen is stale.
+static int
+UpdateStaticLayer(cpSpace *space) {
+  uint32_t version = space_static_version(space);
+  if(static_layer != NULL && static_layer_version == version) return 0;
+
+  if(static_layer == NULL) {
+    SDL_PixelFormat *f = screen->format;
+    static_layer = SDL_CreateRGBSurface(SDL_SWSURFACE, screen->w, screen->h, f->BitsPerPixel, f->Rmask, f->Gmask, f->Bmask, f->Amask);
+    if(static_layer == NULL) {
+      fprintf(stderr, "can't create static layer: %s\n", SDL_GetError());
+      exit(1);
+    }
+  }
+
+  // Recorded like the frames but run here, once the render thread is done
+  // blitting from the layer.
+  recording = &static_list;
+  ResetList(&static_list);
+  cpSpaceEachShape(space, (cpSpaceShapeIteratorFunc)DrawStaticShape, static_layer);
+
+  RenderWait();
+  SDL_FillRect(static_layer, NULL, SCREEN_BG);
+  ExecuteList(&static_list, static_layer);
+
+  static_layer_version = version;
+  return 1;
+}
+
+// DIRTY RECTANGLES
+//
+// Only what changed since the last frame is cleared and redrawn: the areas
+// awake shapes covered last frame and cover now, shapes whose body fell
+// asleep or woke up, and constraints. Changed tiles of a coarse grid are
+// merged into rectangles, which are redrawn clipped and presented with
+// SDL_UpdateRects. A scene that is all asleep redraws nothing.
+
+// Margin around shape bounding boxes for collision dots and outlines.
+#define DIRTY_PAD  6
+
+// Constraint areas of the last frame; constraints are always redrawn.
+static SDL_Rect    *constraint_rects     = NULL;
+static int          num_constraint_rects = 0;
+static int          max_constraint_rects = 0;
+
+static Uint8       *dirty_tiles = NULL;
+static int          tiles_w, tiles_h;
+static int          full_redraw = 1;
 
-  cpSpaceDebugDrawOptions drawOptions = {
+// Redraw everything next frame, e.g. after the window was uncovered.
+static void
+InvalidateScreen(void) {
+  full_redraw = 1;
+}
+
+static SDL_Rect
+RectForBB(cpBB bb) {
+  int l = (int)floor(bb.l) - DIRTY_PAD, t = (int)floor(bb.b) - DIRTY_PAD;
+  int r = (int)ceil (bb.r) + DIRTY_PAD, b = (int)ceil (bb.t) + DIRTY_PAD;
+  if(l < 0) l = 0;
+  if(t < 0) t = 0;
+  if(r > screen->w) r = screen->w;
+  if(b > screen->h) b = screen->h;
+
+  SDL_Rect rect = {0, 0, 0, 0};
+  if(l < r && t < b) {
+    rect.x = l;
+    rect.y = t;
+    rect.w = r - l;
+    rect.h = b - t;
+  }
+  return rect;
+}
+
+static void
+MarkRect(SDL_Rect rect) {
+  if(rect.w == 0 || rect.h == 0) return;
+
+  int tx1 = (rect.x + rect.w - 1)/DIRTY_TILE, ty1 = (rect.y + rect.h - 1)/DIRTY_TILE;
+  for(int ty=rect.y/DIRTY_TILE; ty<=ty1; ty++) {
+    for(int tx=rect.x/DIRTY_TILE; tx<=tx1; tx++) dirty_tiles[ty*tiles_w + tx] = 1;
+  }
+}
+
+static void
+MarkShape(cpShape *shape, cpDataPointer data) {
+  shape_state *state = StateForShape(shape);
+  cpBody *body = shape->body;
+  int sleeping = cpBodyIsSleeping(body);
+  int moving   = !sleeping && cpBodyGetType(body) != CP_BODY_TYPE_STATIC;
+  if(state->drawn && !moving && state->sleeping == sleeping) return;
+
+  if(state->drawn) MarkRect(state->rect);
+  state->rect     = RectForBB(shape->bb);
+  state->drawn    = 1;
+  state->sleeping = sleeping;
+  MarkRect(state->rect);
+}
+
+static void
+MarkConstraint(cpConstraint *constraint, cpDataPointer data) {
+  cpBody *a = constraint->a, *b = constraint->b;
+  cpVect pa = a->p, pb = b->p;
+  if(cpConstraintIsPivotJoint(constraint)) {
+    pa = cpBodyLocalToWorld(a, cpPivotJointGetAnchorA(constraint));
+    pb = cpBodyLocalToWorld(b, cpPivotJointGetAnchorB(constraint));
+  }
+  SDL_Rect rect = RectForBB(cpBBNew(cpfmin(pa.x, pb.x), cpfmin(pa.y, pb.y), cpfmax(pa.x, pb.x), cpfmax(pa.y, pb.y)));
+  MarkRect(rect);
+
+  if(num_constraint_rects == max_constraint_rects) {
+    max_constraint_rects = max_constraint_rects ? max_constraint_rects*2 : 8;
+    constraint_rects = realloc(constraint_rects, sizeof(SDL_Rect)*max_constraint_rects);
+  }
+  constraint_rects[num_constraint_rects++] = rect;
+}
+
+static int
+RectIsDirty(SDL_Rect rect) {
+  if(rect.w == 0 || rect.h == 0) return 0;
+
+  int tx1 = (rect.x + rect.w - 1)/DIRTY_TILE, ty1 = (rect.y + rect.h - 1)/DIRTY_TILE;
+  for(int ty=rect.y/DIRTY_TILE; ty<=ty1; ty++) {
+    for(int tx=rect.x/DIRTY_TILE; tx<=tx1; tx++) {
+      if(dirty_tiles[ty*tiles_w + tx]) return 1;
+    }
+  }
+  return 0;
+}
+
+// Shapes are picked by the same interpolated bounding boxes the tiles were
+// marked from, not through the spatial index, whose boxes are from the last
+// step. Static shapes are in the static layer.
+static void
+DrawDirtyShape(cpShape *shape, cpDataPointer data) {
+  if(cpBodyGetType(shape->body) == CP_BODY_TYPE_STATIC) return;
+  if(RectIsDirty(RectForBB(shape->bb))) DrawShape(shape, data);
+}
+
+// Where a contact point is on the body as drawn, which between steps is the
+// interpolated transform rather than the body's position.
+static cpVect
+ContactPoint(cpBody *body, cpVect r) {
+  cpVect local = cpvadd(cpvunrotate(r, cpvforangle(body->a)), body->cog);
+  return cpTransformPoint(body->transform, local);
+}
+
+// The collision points cpSpaceDebugDraw would draw, at the drawn positions.
+static void
+DrawContacts(cpSpace *space, cpSpaceDebugColor color) {
+  Uint32   c        = MapColor(color);
+  cpArray *arbiters = space->arbiters;
+  for(int i=0; i<arbiters->num; i++) {
+    cpArbiter *arb = (cpArbiter *)arbiters->arr[i];
+    cpVect     n   = cpvmult(arb->n, 2.0f);
+    for(int j=0; j<arb->count; j++) {
+      cpVect p1 = ContactPoint(arb->body_a, arb->contacts[j].r1);
+      cpVect p2 = ContactPoint(arb->body_b, arb->contacts[j].r2);
+      RecordLine(cpvsub(p1, n), cpvadd(p2, n), c);
+    }
+  }
+}
+
+// Runs of dirty tiles in a row become one rectangle, and a rectangle grows
+// down while the next row has a run with the same span.
+static int
+CollectDirtyRects(SDL_Rect *rects) {
+  int count = 0;
+  for(int ty=0; ty<tiles_h; ty++) {
+    for(int tx=0; tx<tiles_w; ) {
+      if(!dirty_tiles[ty*tiles_w + tx]) {
+        tx++;
+        continue;
+      }
+      int start = tx;
+      while(tx < tiles_w && dirty_tiles[ty*tiles_w + tx]) tx++;
+
+      SDL_Rect rect;
+      rect.x = start*DIRTY_TILE;
+      rect.y = ty*DIRTY_TILE;
+      rect.w = cpfmin(tx*DIRTY_TILE, screen->w) - rect.x;
+      rect.h = cpfmin((ty + 1)*DIRTY_TILE, screen->h) - rect.y;
+
+      int merged = 0;
+      for(int i=0; i<count && !merged; i++) {
+        SDL_Rect *above = &rects[i];
+        if(above->x == rect.x && above->w == rect.w && above->y + above->h == rect.y) {
+          above->h += rect.h;
+          merged = 1;
+        }
+      }
+      if(!merged) rects[count++] = rect;
+    }
+  }
+  return count;
+}
+
+// Record what changed into the list being written and return the number of
+// rectangles it will redraw; RenderSubmit draws and presents them.
+static int
+DrawDirty(cpSpace *space) {
+  if(dirty_tiles == NULL) {
+    tiles_w = (screen->w + DIRTY_TILE - 1)/DIRTY_TILE;
+    tiles_h = (screen->h + DIRTY_TILE - 1)/DIRTY_TILE;
+    dirty_tiles = malloc(tiles_w*tiles_h);
+    for(int i=0; i<2; i++) lists[i].rects = malloc(sizeof(SDL_Rect)*tiles_w*tiles_h);
+  }
+
+  if(UpdateStaticLayer(space)) full_redraw = 1;
+  memset(dirty_tiles, full_redraw, tiles_w*tiles_h);
+  full_redraw = 0;
+
+  cpSpaceEachShape(space, (cpSpaceShapeIteratorFunc)MarkShape, NULL);
+
+  for(int i=0; i<num_constraint_rects; i++) MarkRect(constraint_rects[i]);
+  num_constraint_rects = 0;
+  cpSpaceEachConstraint(space, (cpSpaceConstraintIteratorFunc)MarkConstraint, NULL);
+
+  draw_list *list = &lists[writing];
+  recording = list;
+  ResetList(list);
+  list->num_rects = CollectDirtyRects(list->rects);
+  if(list->num_rects == 0) return 0;
+
+  // Constraints on top of the shapes, then contacts. Recorded once for the
+  // whole frame and clipped to its rects when rasterized.
+  cpSpaceDebugDrawOptions overlay = {
     DrawCircle,
     DrawSegment,
     DrawFatSegment,
     DrawPolygon,
     DrawDot,
     
-    (cpSpaceDebugDrawFlags)(CP_SPACE_DEBUG_DRAW_SHAPES | CP_SPACE_DEBUG_DRAW_CONSTRAINTS | CP_SPACE_DEBUG_DRAW_COLLISION_POINTS),
+    CP_SPACE_DEBUG_DRAW_CONSTRAINTS,
     
-    {200.0f/255.0f, 210.0f/255.0f, 230.0f/255.0f, 1.0f},
+    SHAPE_OUTLINE,
     ColorForShape,
     {0.0f, 0.75f, 0.0f, 1.0f},
     {1.0f, 0.0f, 0.0f, 1.0f},
     NULL,
   };
-  
-  cpSpaceDebugDraw(space, &drawOptions);
+
+  for(int i=0; i<list->num_rects; i++) RecordRect(OP_BLIT, list->rects[i]);
+  PushCommand(OP_REGION, 0, 0);
+
+  cpSpaceEachShape(space, (cpSpaceShapeIteratorFunc)DrawDirtyShape, NULL);
+  cpSpaceDebugDraw(space, &overlay);
+  DrawContacts(space, overlay.collisionPointColor);
+
+  return list->num_rects;
 }
@@ -0,0 +1,776 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "space.h"
+
+// A snapshot holds the dynamic state of a space, not its topology: it is
+// restored into a space holding the same objects, e.g. the same scene rebuilt
+// by space_new with the same params. Objects are matched by key, so the
+// order Chipmunk happens to keep them in (which changes as bodies fall
+// asleep) doesn't matter.
+//
+//   body        hashid of its most recently added shape, plus one
+//   shape       hashid
+//   constraint  pair of body keys, then joint class
+//   arbiter     pair of shape hashids
+//
+// Bodies without shapes have no key and are left out.
+//
+// Restoring also puts the space into one canonical layout: body and
+// constraint arrays, spatial indexes, contact graph and sleeping components
+// are rebuilt in key order. What the next step does then depends on the
+// snapshot alone, so restoring the same snapshot twice and stepping both the
+// same way gives the same states bit for bit.
+
+#define SNAPSHOT_MAGIC   0x70616e73u // "snap"
+#define SNAPSHOT_VERSION 2
+
+// Most cpFloats a joint class carries over from step to step.
+#define JOINT_FIELDS 10
+
+enum {
+  JOINT_OTHER,
+  JOINT_PIN,
+  JOINT_SLIDE,
+  JOINT_PIVOT,
+  JOINT_GROOVE,
+  JOINT_SPRING,
+  JOINT_ROTARY_SPRING,
+  JOINT_ROTARY_LIMIT,
+  JOINT_RATCHET,
+  JOINT_GEAR,
+  JOINT_MOTOR,
+};
+
+// Where an arbiter lives: in space->arbiters (touching this step), only in
+// the cache (separated, kept for collisionPersistence steps) or with a
+// sleeping component.
+enum {
+  ARBITER_ACTIVE,
+  ARBITER_CACHED,
+  ARBITER_SLEEPING,
+};
+
+typedef struct snap_header {
+  uint32_t magic, version;
+  uint32_t bodies, shapes, constraints, arbiters;
+  int32_t  iterations, pad;
+  cpFloat  curr_dt;
+} snap_header;
+
+typedef struct snap_body {
+  uint64_t key;
+  uint64_t root;         // key of its sleeping component's root, 0 if awake
+  int32_t  sleep_index;  // position in that component, the root is 0
+  int32_t  pad;
+  cpVect   p, v, f, v_bias;
+  cpFloat  a, w, t, w_bias;
+  cpFloat  idle;
+} snap_body;
+
+typedef struct snap_shape {
+  uint64_t key;
+  cpFloat  e, u;
+  cpVect   surface_v;
+} snap_shape;
+
+typedef struct snap_constraint {
+  uint64_t key;
+  int32_t  kind, count;  // joint class and how many fields it uses
+  cpFloat  max_force, error_bias, max_bias;
+  cpFloat  fields[JOINT_FIELDS];
+} snap_constraint;
+
+typedef struct snap_arbiter {
+  uint64_t         key;
+  uint64_t         a, b;   // shape hashids in arbiter order
+  uint32_t         age;    // steps since the shapes last touched
+  int32_t          state, where, count;
+  cpFloat          e, u;
+  cpVect           surface_vr, n;
+  struct cpContact contacts[CP_MAX_CONTACTS_PER_ARBITER];
+} snap_arbiter;
+
+static uint64_t
+pair_key(uint64_t a, uint64_t b) {
+  return a < b ? (a << 32 | (b & 0xffffffff)) : (b << 32 | (a & 0xffffffff));
+}
+
+static int
+cmp_key(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static int
+cmp_ptr(const void *a, const void *b) {
+  uintptr_t x = (uintptr_t)*(void *const *)a;
+  uintptr_t y = (uintptr_t)*(void *const *)b;
+  return (x > y) - (x < y);
+}
+
+static int
+cmp_body(const void *a, const void *b) {
+  uint64_t x = space_body_key(*(cpBody *const *)a);
+  uint64_t y = space_body_key(*(cpBody *const *)b);
+  return (x > y) - (x < y);
+}
+
+static int
+cmp_shape(const void *a, const void *b) {
+  cpHashValue x = (*(cpShape *const *)a)->hashid;
+  cpHashValue y = (*(cpShape *const *)b)->hashid;
+  return (x > y) - (x < y);
+}
+
+// Points fields at the state a joint carries from one step to the next: its
+// settings and the accumulated impulse that warm starts the solver. The rest
+// is recomputed by the next prestep. Returns the joint class.
+static int
+joint_fields(cpConstraint *c, cpFloat *fields[JOINT_FIELDS], int *count) {
+  int n = 0;
+#define FIELD(x)  (fields[n++] = &(x))
+#define VFIELD(v) (FIELD((v).x), FIELD((v).y))
+
+  int kind = JOINT_OTHER;
+  if(cpConstraintIsPinJoint(c)) {
+    struct cpPinJoint *j = (struct cpPinJoint *)c;
+    VFIELD(j->anchorA); VFIELD(j->anchorB); FIELD(j->dist); FIELD(j->jnAcc);
+    kind = JOINT_PIN;
+  } else if(cpConstraintIsSlideJoint(c)) {
+    struct cpSlideJoint *j = (struct cpSlideJoint *)c;
+    VFIELD(j->anchorA); VFIELD(j->anchorB); FIELD(j->min); FIELD(j->max); FIELD(j->jnAcc);
+    kind = JOINT_SLIDE;
+  } else if(cpConstraintIsPivotJoint(c)) {
+    struct cpPivotJoint *j = (struct cpPivotJoint *)c;
+    VFIELD(j->anchorA); VFIELD(j->anchorB); VFIELD(j->jAcc);
+    kind = JOINT_PIVOT;
+  } else if(cpConstraintIsGrooveJoint(c)) {
+    struct cpGrooveJoint *j = (struct cpGrooveJoint *)c;
+    VFIELD(j->grv_n); VFIELD(j->grv_a); VFIELD(j->grv_b); VFIELD(j->anchorB); VFIELD(j->jAcc);
+    kind = JOINT_GROOVE;
+  } else if(cpConstraintIsDampedSpring(c)) {
+    struct cpDampedSpring *j = (struct cpDampedSpring *)c;
+    VFIELD(j->anchorA); VFIELD(j->anchorB);
+    FIELD(j->restLength); FIELD(j->stiffness); FIELD(j->damping); FIELD(j->jAcc);
+    kind = JOINT_SPRING;
+  } else if(cpConstraintIsDampedRotarySpring(c)) {
+    struct cpDampedRotarySpring *j = (struct cpDampedRotarySpring *)c;
+    FIELD(j->restAngle); FIELD(j->stiffness); FIELD(j->damping); FIELD(j->jAcc);
+    kind = JOINT_ROTARY_SPRING;
+  } else if(cpConstraintIsRotaryLimitJoint(c)) {
+    struct cpRotaryLimitJoint *j = (struct cpRotaryLimitJoint *)c;
+    FIELD(j->min); FIELD(j->max); FIELD(j->jAcc);
+    kind = JOINT_ROTARY_LIMIT;
+  } else if(cpConstraintIsRatchetJoint(c)) {
+    struct cpRatchetJoint *j = (struct cpRatchetJoint *)c;
+    FIELD(j->angle); FIELD(j->phase); FIELD(j->ratchet); FIELD(j->jAcc);
+    kind = JOINT_RATCHET;
+  } else if(cpConstraintIsGearJoint(c)) {
+    struct cpGearJoint *j = (struct cpGearJoint *)c;
+    FIELD(j->phase); FIELD(j->ratio); FIELD(j->ratio_inv); FIELD(j->jAcc);
+    kind = JOINT_GEAR;
+  } else if(cpConstraintIsSimpleMotor(c)) {
+    struct cpSimpleMotor *j = (struct cpSimpleMotor *)c;
+    FIELD(j->rate); FIELD(j->jAcc);
+    kind = JOINT_MOTOR;
+  }
+
+#undef VFIELD
+#undef FIELD
+  *count = n;
+  return kind;
+}
+
+typedef struct constraint_ref {
+  uint64_t      key;
+  int           kind;
+  cpConstraint *constraint;
+} constraint_ref;
+
+static int
+cmp_constraint(const void *a, const void *b) {
+  const constraint_ref *x = a, *y = b;
+  if(x->key != y->key) return (x->key > y->key) - (x->key < y->key);
+  return (x->kind > y->kind) - (x->kind < y->kind);
+}
+
+static void
+push_constraint(cpConstraint *constraint, constraint_ref *refs, int *count) {
+  cpFloat *fields[JOINT_FIELDS];
+  int n;
+
+  constraint_ref *ref = &refs[(*count)++];
+  ref->key        = pair_key(space_body_key(constraint->a), space_body_key(constraint->b));
+  ref->kind       = joint_fields(constraint, fields, &n);
+  ref->constraint = constraint;
+}
+
+// Every constraint sorted by key and class. Sleeping components own theirs
+// outside space->constraints, with the same owner rule Chipmunk uses.
+// Constraints with equal keys and classes keep the order they are found in.
+static constraint_ref *
+collect_constraints(cpSpace *space, int *count) {
+  int total = space->constraints->num;
+  cpArray *components = space->sleepingComponents;
+  for(int i=0; i<components->num; i++) {
+    CP_BODY_FOREACH_COMPONENT((cpBody *)components->arr[i], body) {
+      CP_BODY_FOREACH_CONSTRAINT(body, c) total++;
+    }
+  }
+
+  constraint_ref *refs = malloc(sizeof(constraint_ref)*(total ? total : 1));
+  if(refs == NULL) return NULL;
+
+  *count = 0;
+  for(int i=0; i<space->constraints->num; i++) push_constraint(space->constraints->arr[i], refs, count);
+  for(int i=0; i<components->num; i++) {
+    CP_BODY_FOREACH_COMPONENT((cpBody *)components->arr[i], body) {
+      CP_BODY_FOREACH_CONSTRAINT(body, c) {
+        if(body == c->a || cpBodyGetType(c->a) == CP_BODY_TYPE_STATIC) push_constraint(c, refs, count);
+      }
+    }
+  }
+
+  qsort(refs, *count, sizeof(constraint_ref), cmp_constraint);
+  return refs;
+}
+
+// SNAPSHOT
+
+// Appends records while they fit, always counting the size they would need.
+typedef struct snap_writer {
+  unsigned char *buf;
+  size_t         size, used;
+  uint32_t       count;
+  cpSpace       *space;
+  void         **active;  // space->arbiters, sorted to look arbiters up
+  int            num_active;
+} snap_writer;
+
+static void *
+writer_push(snap_writer *w, size_t size) {
+  size_t at = w->used;
+  w->used += size;
+  w->count++;
+  return (w->buf && w->used <= w->size) ? w->buf + at : NULL;
+}
+
+static void
+write_body(cpBody *body, uint64_t root, int sleep_index, snap_writer *w) {
+  if(cpBodyGetType(body) == CP_BODY_TYPE_STATIC || space_body_key(body) == 0) return;
+
+  snap_body *rec = writer_push(w, sizeof(snap_body));
+  if(rec == NULL) return;
+
+  memset(rec, 0, sizeof(snap_body));
+  rec->key         = space_body_key(body);
+  rec->root        = root;
+  rec->sleep_index = sleep_index;
+  rec->p           = body->p;
+  rec->v           = body->v;
+  rec->f           = body->f;
+  rec->v_bias      = body->v_bias;
+  rec->a           = body->a;
+  rec->w           = body->w;
+  rec->t           = body->t;
+  rec->w_bias      = body->w_bias;
+  rec->idle        = body->sleeping.idleTime;
+}
+
+static void
+write_shape(cpShape *shape, snap_writer *w) {
+  snap_shape *rec = writer_push(w, sizeof(snap_shape));
+  if(rec == NULL) return;
+
+  rec->key       = shape->hashid;
+  rec->e         = shape->e;
+  rec->u         = shape->u;
+  rec->surface_v = shape->surfaceV;
+}
+
+static void
+write_constraint(cpConstraint *constraint, snap_writer *w) {
+  snap_constraint *rec = writer_push(w, sizeof(snap_constraint));
+  if(rec == NULL) return;
+
+  cpFloat *fields[JOINT_FIELDS];
+  int n;
+
+  memset(rec, 0, sizeof(snap_constraint));
+  rec->key        = pair_key(space_body_key(constraint->a), space_body_key(constraint->b));
+  rec->kind       = joint_fields(constraint, fields, &n);
+  rec->count      = n;
+  rec->max_force  = constraint->maxForce;
+  rec->error_bias = constraint->errorBias;
+  rec->max_bias   = constraint->maxBias;
+  for(int i=0; i<n; i++) rec->fields[i] = *fields[i];
+}
+
+static void
+write_arbiter(cpArbiter *arb, snap_writer *w) {
+  snap_arbiter *rec = writer_push(w, sizeof(snap_arbiter));
+  if(rec == NULL) return;
+
+  memset(rec, 0, sizeof(snap_arbiter));
+  rec->key        = pair_key(arb->a->hashid, arb->b->hashid);
+  rec->a          = arb->a->hashid;
+  rec->b          = arb->b->hashid;
+  rec->state      = arb->state;
+  rec->count      = arb->count;
+  rec->e          = arb->e;
+  rec->u          = arb->u;
+  rec->surface_vr = arb->surface_vr;
+  rec->n          = arb->n;
+  if(arb->count > 0) memcpy(rec->contacts, arb->contacts, arb->count*sizeof(struct cpContact));
+
+  // Only stamp differences mean anything to Chipmunk, so the age is kept
+  // rather than the stamp itself.
+  if(cpBodyIsSleeping(arb->body_a) || cpBodyIsSleeping(arb->body_b)) {
+    rec->where = ARBITER_SLEEPING;
+  } else {
+    rec->age   = w->space->stamp - arb->stamp;
+    rec->where = bsearch(&arb, w->active, w->num_active, sizeof(void *), cmp_ptr) ? ARBITER_ACTIVE : ARBITER_CACHED;
+  }
+}
+
+size_t
+space_snapshot(cpSpace *space, void *buf, size_t size) {
+  int num_constraints = 0;
+  constraint_ref *constraints = collect_constraints(space, &num_constraints);
+  void **active = malloc(sizeof(void *)*(space->arbiters->num ? space->arbiters->num : 1));
+  if(constraints == NULL || active == NULL) {
+    free(constraints);
+    free(active);
+    return 0;
+  }
+  memcpy(active, space->arbiters->arr, sizeof(void *)*space->arbiters->num);
+  qsort(active, space->arbiters->num, sizeof(void *), cmp_ptr);
+
+  snap_writer w = {buf, size, 0, 0, space, active, space->arbiters->num};
+  snap_header *header = writer_push(&w, sizeof(snap_header));
+
+  // Sleeping bodies are written component by component so each knows its
+  // root and its place in the chain. Keyless bodies can't be matched, so
+  // the first keyed body stands in as the root.
+  size_t bodies_at = w.used;
+  w.count = 0;
+  for(int i=0; i<space->dynamicBodies->num; i++) write_body(space->dynamicBodies->arr[i], 0, 0, &w);
+  for(int i=0; i<space->sleepingComponents->num; i++) {
+    uint64_t root = 0;
+    int index = 0;
+    CP_BODY_FOREACH_COMPONENT((cpBody *)space->sleepingComponents->arr[i], body) {
+      if(space_body_key(body) == 0) continue;
+      if(root == 0) root = space_body_key(body);
+      write_body(body, root, index++, &w);
+    }
+  }
+  uint32_t bodies = w.count;
+
+  size_t shapes_at = w.used;
+  w.count = 0;
+  cpSpaceEachShape(space, (cpSpaceShapeIteratorFunc)write_shape, &w);
+  uint32_t shapes = w.count;
+
+  w.count = 0;
+  for(int i=0; i<num_constraints; i++) write_constraint(constraints[i].constraint, &w);
+  uint32_t num_written = w.count;
+
+  size_t arbiters_at = w.used;
+  w.count = 0;
+  cpHashSetEach(space->cachedArbiters, (cpHashSetIteratorFunc)write_arbiter, &w);
+  for(int i=0; i<space->sleepingComponents->num; i++) {
+    CP_BODY_FOREACH_COMPONENT((cpBody *)space->sleepingComponents->arr[i], body) {
+      CP_BODY_FOREACH_ARBITER(body, arb) {
+        if(body == arb->body_a || cpBodyGetType(arb->body_a) == CP_BODY_TYPE_STATIC) write_arbiter(arb, &w);
+      }
+    }
+  }
+  uint32_t arbiters = w.count;
+
+  free(constraints);
+  free(active);
+  if(header == NULL || w.used > size) return w.used;
+
+  header->magic       = SNAPSHOT_MAGIC;
+  header->version     = SNAPSHOT_VERSION;
+  header->bodies      = bodies;
+  header->shapes      = shapes;
+  header->constraints = num_written;
+  header->arbiters    = arbiters;
+  header->iterations  = space->iterations;
+  header->pad         = 0;
+  header->curr_dt     = space->curr_dt;
+
+  // Sorted by key so restore can match records against sorted objects.
+  // Constraints are written in order already.
+  unsigned char *base = buf;
+  qsort(base + bodies_at,   bodies,   sizeof(snap_body),    cmp_key);
+  qsort(base + shapes_at,   shapes,   sizeof(snap_shape),   cmp_key);
+  qsort(base + arbiters_at, arbiters, sizeof(snap_arbiter), cmp_key);
+
+  return w.used;
+}
+
+// RESTORE
+
+typedef struct snap_reader {
+  const snap_header     *header;
+  const snap_body       *bodies;
+  const snap_shape      *shapes;
+  const snap_constraint *constraints;
+  const snap_arbiter    *arbiters;
+
+  // The space's objects, sorted the same way as their records.
+  cpArray        *body_list;
+  cpArray        *shape_list;
+  constraint_ref *constraint_list;
+  int             num_constraints;
+} snap_reader;
+
+static void
+collect_body(cpBody *body, cpArray *bodies) {
+  if(cpBodyGetType(body) != CP_BODY_TYPE_STATIC && space_body_key(body) != 0) cpArrayPush(bodies, body);
+}
+
+static void
+collect_shape(cpShape *shape, cpArray *shapes) {
+  cpArrayPush(shapes, shape);
+}
+
+static cpShape *
+find_shape(const snap_reader *r, uint64_t hashid) {
+  int lo = 0, hi = r->shape_list->num;
+  while(lo < hi) {
+    int mid = (lo + hi)/2;
+    cpShape *shape = r->shape_list->arr[mid];
+    if(shape->hashid == hashid) return shape;
+    if(shape->hashid < hashid) lo = mid + 1; else hi = mid;
+  }
+  return NULL;
+}
+
+// The record of a shape's body, NULL for static bodies.
+static const snap_body *
+find_body(const snap_reader *r, const cpShape *shape) {
+  if(cpBodyGetType(shape->body) == CP_BODY_TYPE_STATIC) return NULL;
+  uint64_t key = space_body_key(shape->body);
+  return bsearch(&key, r->bodies, r->header->bodies, sizeof(snap_body), cmp_key);
+}
+
+// Everything a restore relies on, checked before the space is touched.
+static cpBool
+check_snapshot(cpSpace *space, snap_reader *r) {
+  const snap_header *header = r->header;
+
+  if((uint32_t)r->body_list->num != header->bodies) return cpFalse;
+  for(int i=0; i<r->body_list->num; i++) {
+    const snap_body *rec = &r->bodies[i];
+    if(space_body_key(r->body_list->arr[i]) != rec->key) return cpFalse;
+    if(rec->root == 0) continue;
+
+    // Sleepers need sleeping enabled, a dynamic body and a root that is a
+    // sleeper itself, at the head of its own component.
+    const snap_body *root = bsearch(&rec->root, r->bodies, header->bodies, sizeof(snap_body), cmp_key);
+    if(space->sleepTimeThreshold == INFINITY) return cpFalse;
+    if(cpBodyGetType(r->body_list->arr[i]) != CP_BODY_TYPE_DYNAMIC) return cpFalse;
+    if(root == NULL || root->root != root->key || root->sleep_index != 0) return cpFalse;
+    if((rec == root) != (rec->sleep_index == 0)) return cpFalse;
+  }
+
+  if((uint32_t)r->shape_list->num != header->shapes) return cpFalse;
+  for(int i=0; i<r->shape_list->num; i++) {
+    if(((cpShape *)r->shape_list->arr[i])->hashid != r->shapes[i].key) return cpFalse;
+  }
+
+  if((uint32_t)r->num_constraints != header->constraints) return cpFalse;
+  for(int i=0; i<r->num_constraints; i++) {
+    const snap_constraint *rec = &r->constraints[i];
+    cpFloat *fields[JOINT_FIELDS];
+    int n;
+
+    joint_fields(r->constraint_list[i].constraint, fields, &n);
+    if(r->constraint_list[i].key != rec->key || r->constraint_list[i].kind != rec->kind || n != rec->count) return cpFalse;
+  }
+
+  // Sleeping arbiters join sleeping (or static) bodies only, the others
+  // awake ones only, or the contact graph would dangle after the next step.
+  for(uint32_t i=0; i<header->arbiters; i++) {
+    const snap_arbiter *rec = &r->arbiters[i];
+    if(i > 0 && rec->key <= r->arbiters[i - 1].key) return cpFalse;
+    if(rec->count < 0 || rec->count > CP_MAX_CONTACTS_PER_ARBITER) return cpFalse;
+    if(rec->where < ARBITER_ACTIVE || rec->where > ARBITER_SLEEPING) return cpFalse;
+    if(rec->state < CP_ARBITER_STATE_FIRST_COLLISION || rec->state > CP_ARBITER_STATE_INVALIDATED) return cpFalse;
+
+    cpShape *a = find_shape(r, rec->a), *b = find_shape(r, rec->b);
+    if(a == NULL || b == NULL || a->body == b->body) return cpFalse;
+
+    const snap_body *body_a = find_body(r, a), *body_b = find_body(r, b);
+    if(body_a == NULL && body_b == NULL) return cpFalse;
+
+    cpBool sleeping = (rec->where == ARBITER_SLEEPING);
+    if(body_a && (body_a->root != 0) != sleeping) return cpFalse;
+    if(body_b && (body_b->root != 0) != sleeping) return cpFalse;
+  }
+
+  return cpTrue;
+}
+
+// Fills the arbiter pool up front, the same way Chipmunk does (a buffer of
+// arbiters at a time, owned by the space), so a restore can't run out
+// halfway through.
+static cpBool
+reserve_arbiters(cpSpace *space, int count) {
+  int per_buffer = CP_BUFFER_BYTES/sizeof(cpArbiter);
+
+  while(space->pooledArbiters->num < count) {
+    cpArbiter *buffer = (cpArbiter *)cpcalloc(1, CP_BUFFER_BYTES);
+    if(buffer == NULL) return cpFalse;
+
+    cpArrayPush(space->allocatedBuffers, buffer);
+    for(int i=0; i<per_buffer; i++) cpArrayPush(space->pooledArbiters, buffer + i);
+  }
+  return cpTrue;
+}
+
+static cpBool
+drop_arbiter(cpArbiter *arb, cpSpace *space) {
+  cpArbiterUnthread(arb);
+  cpArrayPush(space->pooledArbiters, arb);
+  return cpFalse;
+}
+
+// Same as Chipmunk's own handler lookup in cpArbiterUpdate.
+static cpCollisionHandler *
+lookup_handler(cpSpace *space, cpCollisionType a, cpCollisionType b, cpCollisionHandler *fallback) {
+  cpCollisionType types[] = {a, b};
+  cpCollisionHandler *handler = (cpCollisionHandler *)cpHashSetFind(space->collisionHandlers, CP_HASH_PAIR(a, b), types);
+  return handler ? handler : fallback;
+}
+
+static void
+push_arbiter(cpBody *body, cpArbiter *arb) {
+  cpArbiter *next = body->arbiterList;
+  cpArbiterThreadForBody(arb, body)->next = next;
+  if(next) cpArbiterThreadForBody(next, body)->prev = arb;
+  body->arbiterList = arb;
+}
+
+static void
+restore_arbiter(cpSpace *space, const snap_arbiter *rec, cpShape *a, cpShape *b) {
+  cpArbiter *arb = cpArbiterInit((cpArbiter *)cpArrayPop(space->pooledArbiters), a, b);
+
+  arb->e          = rec->e;
+  arb->u          = rec->u;
+  arb->surface_vr = rec->surface_vr;
+  arb->n          = rec->n;
+  arb->stamp      = space->stamp - rec->age;
+  arb->state      = (enum cpArbiterState)rec->state;
+
+  cpCollisionHandler *fallback = &space->defaultHandler;
+  cpCollisionHandler *handler = arb->handler = lookup_handler(space, a->type, b->type, fallback);
+  cpBool swapped = arb->swapped = (a->type != handler->typeA && handler->typeA != CP_WILDCARD_COLLISION_TYPE);
+  if(handler != fallback || space->usesWildcards) {
+    arb->handlerA = lookup_handler(space, swapped ? b->type : a->type, CP_WILDCARD_COLLISION_TYPE, &cpCollisionHandlerDoNothing);
+    arb->handlerB = lookup_handler(space, swapped ? a->type : b->type, CP_WILDCARD_COLLISION_TYPE, &cpCollisionHandlerDoNothing);
+  }
+
+  arb->count = rec->count;
+  if(rec->count > 0) {
+    arb->contacts = cpContactBufferGetArray(space);
+    memcpy(arb->contacts, rec->contacts, rec->count*sizeof(struct cpContact));
+    cpSpacePushContacts(space, rec->count);
+  }
+
+  const cpShape *shape_pair[] = {a, b};
+  cpHashSetInsert(space->cachedArbiters, CP_HASH_PAIR((cpHashValue)a, (cpHashValue)b), shape_pair, NULL, arb);
+
+  // Touching arbiters are in the contact graph, the way cpSpaceStep leaves
+  // them. Sleeping ones are too, and move out of the cache again when their
+  // bodies are put back to sleep.
+  if(rec->where != ARBITER_CACHED) {
+    push_arbiter(arb->body_a, arb);
+    push_arbiter(arb->body_b, arb);
+  }
+  if(rec->where == ARBITER_ACTIVE) cpArrayPush(space->arbiters, arb);
+}
+
+static void
+restore_body(cpBody *body, const snap_body *rec) {
+  body->p      = rec->p;
+  body->v      = rec->v;
+  body->f      = rec->f;
+  body->v_bias = rec->v_bias;
+  body->a      = rec->a;
+  body->w      = rec->w;
+  body->t      = rec->t;
+  body->w_bias = rec->w_bias;
+  space_set_transform(body, body->p, body->a);
+}
+
+static void
+restore_constraint(cpConstraint *constraint, const snap_constraint *rec) {
+  cpFloat *fields[JOINT_FIELDS];
+  int n;
+
+  joint_fields(constraint, fields, &n);
+  constraint->maxForce  = rec->max_force;
+  constraint->errorBias = rec->error_bias;
+  constraint->maxBias   = rec->max_bias;
+  for(int i=0; i<n; i++) *fields[i] = rec->fields[i];
+}
+
+// Takes every shape out of an index and puts it back in hashid order, so its
+// layout (and with it the order collision pairs come out in) no longer
+// depends on the history of the space.
+static void
+rebuild_index(cpSpatialIndex *index) {
+  cpArray *shapes = cpArrayNew(0);
+  cpSpatialIndexEach(index, (cpSpatialIndexIteratorFunc)collect_shape, shapes);
+  qsort(shapes->arr, shapes->num, sizeof(void *), cmp_shape);
+
+  for(int i=0; i<shapes->num; i++) {
+    cpShape *shape = shapes->arr[i];
+    cpSpatialIndexRemove(index, shape, shape->hashid);
+  }
+  for(int i=0; i<shapes->num; i++) {
+    cpShape *shape = shapes->arr[i];
+    cpSpatialIndexInsert(index, shape, shape->hashid);
+  }
+  cpArrayFree(shapes);
+}
+
+typedef struct sleeper {
+  uint64_t root;
+  int      index;
+  cpBody  *body;
+} sleeper;
+
+static int
+cmp_sleeper(const void *a, const void *b) {
+  const sleeper *x = a, *y = b;
+  if(x->root != y->root) return (x->root > y->root) - (x->root < y->root);
+  return (x->index > y->index) - (x->index < y->index);
+}
+
+// Puts components back to sleep in root key order. cpBodySleepWithGroup
+// links each body in right behind the root, so members go in back to front
+// to come out in their saved order.
+static void
+restore_sleep(snap_reader *r, sleeper *sleepers) {
+  int count = 0;
+  for(int i=0; i<r->body_list->num; i++) {
+    if(r->bodies[i].root == 0) continue;
+    sleepers[count].root  = r->bodies[i].root;
+    sleepers[count].index = r->bodies[i].sleep_index;
+    sleepers[count].body  = r->body_list->arr[i];
+    count++;
+  }
+  qsort(sleepers, count, sizeof(sleeper), cmp_sleeper);
+
+  for(int i=0; i<count; ) {
+    int end = i + 1;
+    while(end < count && sleepers[end].root == sleepers[i].root) end++;
+
+    cpBody *root = sleepers[i].body;
+    cpBodySleep(root);
+    for(int j=end - 1; j>i; j--) cpBodySleepWithGroup(sleepers[j].body, root);
+    i = end;
+  }
+}
+
+static void
+restore_space(cpSpace *space, snap_reader *r, sleeper *sleepers) {
+  const snap_header *header = r->header;
+
+  // Wake everything: sleeping components hold their own arbiters and
+  // constraints and their shapes sit in the static index.
+  while(space->sleepingComponents->num > 0) cpBodyActivate(space->sleepingComponents->arr[0]);
+
+  // Then drop the whole contact graph, to be rebuilt from the snapshot.
+  cpHashSetFilter(space->cachedArbiters, (cpHashSetFilterFunc)drop_arbiter, space);
+  space->arbiters->num = 0;
+
+  for(int i=0; i<r->body_list->num; i++) restore_body(r->body_list->arr[i], &r->bodies[i]);
+  for(int i=0; i<r->shape_list->num; i++) {
+    cpShape *shape = r->shape_list->arr[i];
+    shape->e        = r->shapes[i].e;
+    shape->u        = r->shapes[i].u;
+    shape->surfaceV = r->shapes[i].surface_v;
+  }
+  for(int i=0; i<r->num_constraints; i++) restore_constraint(r->constraint_list[i].constraint, &r->constraints[i]);
+
+  // Canonical layout: everything in key order.
+  qsort(space->dynamicBodies->arr, space->dynamicBodies->num, sizeof(void *), cmp_body);
+  if(space->constraints->num == r->num_constraints) {
+    for(int i=0; i<r->num_constraints; i++) space->constraints->arr[i] = r->constraint_list[i].constraint;
+  }
+  // Static first: reinserting dynamic shapes pairs them with static ones.
+  rebuild_index(space->staticShapes);
+  rebuild_index(space->dynamicShapes);
+
+  if(space->contactBuffersHead == NULL) cpSpacePushFreshContactBuffer(space);
+  for(uint32_t i=0; i<header->arbiters; i++) {
+    const snap_arbiter *rec = &r->arbiters[i];
+    restore_arbiter(space, rec, find_shape(r, rec->a), find_shape(r, rec->b));
+  }
+
+  restore_sleep(r, sleepers);
+
+  // Last, since waking and sleeping bodies resets idle times.
+  for(int i=0; i<r->body_list->num; i++) ((cpBody *)r->body_list->arr[i])->sleeping.idleTime = r->bodies[i].idle;
+
+  space->iterations = header->iterations;
+  space->curr_dt    = header->curr_dt;
+}
+
+cpBool
+space_restore(cpSpace *space, const void *buf, size_t size) {
+  const unsigned char *base = buf;
+  const snap_header *header = buf;
+
+  if(space->locked) return cpFalse;
+  if(size < sizeof(snap_header) || header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION) return cpFalse;
+
+  size_t need =
+    sizeof(snap_header) +
+    header->bodies*sizeof(snap_body) +
+    header->shapes*sizeof(snap_shape) +
+    header->constraints*sizeof(snap_constraint) +
+    header->arbiters*sizeof(snap_arbiter);
+  if(size < need) return cpFalse;
+
+  snap_reader r;
+  r.header      = header;
+  r.bodies      = (const snap_body *)(base + sizeof(snap_header));
+  r.shapes      = (const snap_shape *)(r.bodies + header->bodies);
+  r.constraints = (const snap_constraint *)(r.shapes + header->shapes);
+  r.arbiters    = (const snap_arbiter *)(r.constraints + header->constraints);
+
+  // Gather first: waking bodies reshuffles the arrays cpSpaceEachBody walks.
+  r.body_list  = cpArrayNew(0);
+  r.shape_list = cpArrayNew(0);
+  cpSpaceEachBody(space, (cpSpaceBodyIteratorFunc)collect_body, r.body_list);
+  cpSpaceEachShape(space, (cpSpaceShapeIteratorFunc)collect_shape, r.shape_list);
+  qsort(r.body_list->arr, r.body_list->num, sizeof(void *), cmp_body);
+  qsort(r.shape_list->arr, r.shape_list->num, sizeof(void *), cmp_shape);
+  r.num_constraints = 0;
+  r.constraint_list = collect_constraints(space, &r.num_constraints);
+
+  sleeper *sleepers = malloc(sizeof(sleeper)*(r.body_list->num ? r.body_list->num : 1));
+
+  cpBool ok =
+    r.constraint_list && sleepers &&
+    check_snapshot(space, &r) &&
+    reserve_arbiters(space, header->arbiters);
+  if(ok) restore_space(space, &r, sleepers);
+
+  free(sleepers);
+  free(r.constraint_list);
+  cpArrayFree(r.shape_list);
+  cpArrayFree(r.body_list);
+  return ok;
+}
@@ -1,166 +1,664 @@
+#include <string.h>
+
 #include "space.h"
+#include "replay.h"
+#include "contact.h"
+#include "step.h"
 
 cpShapeFilter GRAB_FILTER = {CP_NO_GROUP, GRABBABLE_MASK_BIT, GRABBABLE_MASK_BIT};
 cpShapeFilter NOT_GRABBABLE_FILTER = {CP_NO_GROUP, ~GRABBABLE_MASK_BIT, ~GRABBABLE_MASK_BIT};
 
-static cpBody  *mouse_body       = NULL;
-static cpConstraint *mouse_joint = NULL;
-static cpVect mouse_pnt;
+// Body state captured before the most recent step, used to draw in between
+// two fixed steps.
+typedef struct interp_state {
+  cpBody     *body;
+  cpVect      p;
+  cpFloat     a;
+  cpTransform transform;
+} interp_state;
+
+// Everything space.c keeps about one space. It hangs off the space's user
+// data so any number of spaces can be driven at once, each on its own thread.
+typedef struct space_ctx {
+  cpBody       *mouse_body;
+  cpConstraint *mouse_joint;
+  cpVect        mouse_pnt;
+
+  // Set when the space was created by cpHastySpaceNew and must be stepped and
+  // freed through the hasty API.
+  int           hasty;
+  space_index   index;
+  cpFloat       hash_dim;    // spatial hash in use with SPACE_INDEX_HASH
+  int           hash_count;
+
+  uint32_t      step_index;
+  int           hash_steps;
+  uint64_t      state_hash;
+
+  int           profile;
+  space_stats   stats;
+
+  cpFloat       step_budget;
+  int           min_iterations, max_iterations;
+  uint64_t      window_ns;  // step time summed over the current adapt window
+  int           window_steps;
+  replay_log   *recorder;
+
+  contact_ring *rings[SPACE_CONTACT_RINGS];
+  int           num_rings;
+
+  // Backing storage of the scene objects when built with params->arena.
+  scene_arena   store;
+  scene_arena  *arena;
+
+  interp_state *interp;
+  int           interp_num, interp_max;
+
+  // Bumped whenever static geometry changes, see space_static_version.
+  uint32_t      static_version;
+} space_ctx;
+
+static inline space_ctx *
+get_ctx(cpSpace *space) {
+  return (space_ctx *)cpSpaceGetUserData(space);
+}
+
+static void update_cursor(space_ctx *ctx, double dt);
+static void capture_interp(cpSpace *space, space_ctx *ctx);
+
+// Everything added to a space, gathered for teardown.
+typedef struct space_children {
+  cpArray *shapes;
+  cpArray *constraints;
+  cpArray *bodies;
+} space_children;
 
-static void update_cursor();
-static void freeSpaceChildren(cpSpace *space);
+static void collectSpaceChildren(cpSpace *space, space_children *children);
+static void freeSpaceChildren(space_children *children, scene_arena *arena);
+static void use_index(cpSpace *space, const space_params *params);
+static void adapt_iterations(cpSpace *space, space_ctx *ctx, uint64_t ns);
+
+void
+space_params_default(space_params *params) {
+  scene_params_default(&params->scene);
+  params->threads    = 0;
+  params->index      = SPACE_INDEX_BBTREE;
+  params->hash_dim   = 0.0f;
+  params->hash_count = 0;
+  params->arena      = 0;
+  params->hash       = 0;
+  params->profile    = 0;
+
+  params->step_budget    = 0.0f;
+  params->min_iterations = 2;
+  params->max_iterations = 30;
+}
 
 cpSpace *
 space_init(int width, int height) {
+  return space_new(width, height, NULL);
+}
+
+cpSpace *
+space_new(int width, int height, const space_params *params) {
+
+  space_params defaults;
+  if(params == NULL) {
+    space_params_default(&defaults);
+    params = &defaults;
+  }
+
+  space_ctx *ctx = calloc(1, sizeof(space_ctx));
+  if(ctx == NULL) return NULL;
+
+  cpSpace *space;
+  ctx->hasty = params->threads > 0;
+  if(ctx->hasty) {
+    space = cpHastySpaceNew();
+    cpHastySpaceSetThreads(space, params->threads);
+  } else {
+    space = cpSpaceNew();
+  }
+  cpSpaceSetUserData(space, ctx);
 
-  cpSpace *space = cpSpaceNew();
   cpSpaceSetIterations(space, 5);
   cpSpaceSetGravity(space, cpv(0, 100));
   cpSpaceSetSleepTimeThreshold(space, 0.5f);
   cpSpaceSetCollisionSlop(space, 0.5f);
   
-  cpBody *body, *staticBody = cpSpaceGetStaticBody(space);
-  cpShape *shape;
-  
-  // Create segments around the edge of the screen.
-  shape = cpSpaceAddShape(space, cpSegmentShapeNew(staticBody, cpv(0,-height), cpv(0,height), 0.0f));
-  cpShapeSetElasticity(shape, 1.0f);
-  cpShapeSetFriction(shape, 1.0f);
-  cpShapeSetFilter(shape, NOT_GRABBABLE_FILTER);
-
-  shape = cpSpaceAddShape(space, cpSegmentShapeNew(staticBody, cpv(width,-height), cpv(width,height), 0.0f));
-  cpShapeSetElasticity(shape, 1.0f);
-  cpShapeSetFriction(shape, 1.0f);
-  cpShapeSetFilter(shape, NOT_GRABBABLE_FILTER);
-
-  shape = cpSpaceAddShape(space, cpSegmentShapeNew(staticBody, cpv(0,height), cpv(width,height), 0.0f));
-  cpShapeSetElasticity(shape, 1.0f);
-  cpShapeSetFriction(shape, 1.0f);
-  cpShapeSetFilter(shape, NOT_GRABBABLE_FILTER);
-  
-  // Add lots of boxes.
-  for(int i=0; i<12; i++){
-    for(int j=0; j<=i; j++){
-
-      float size = 20.0;
-      body = cpSpaceAddBody(space, cpBodyNew(1.0f, cpMomentForBox(1.0f, size, size*1.618)));
-      cpBodySetPosition(body, cpv(width/2+j*32 - i*16, i*size*2.0));
-      
-      shape = cpSpaceAddShape(space, cpBoxShapeNew(body, size, size*1.618, 0.5f));
-      cpShapeSetElasticity(shape, 0.0f);
-      cpShapeSetFriction(shape, 0.8f);
-    
-    }
+  // Out of memory in the middle of the scene: space_destroy takes down what
+  // was built so far, arenas included.
+  if(params->arena) ctx->arena = &ctx->store;
+  if(
+    (ctx->arena && !scene_arena_init(ctx->arena, &params->scene)) ||
+    !scene_build(space, width, height, &params->scene, ctx->arena)
+  ) {
+    space_destroy(space);
+    return NULL;
   }
-  
-  // Add a ball to make things more interesting
-  cpFloat radius = 15.0f;
-  body = cpSpaceAddBody(space, cpBodyNew(10.0f, cpMomentForCircle(10.0f, 0.0f, radius, cpvzero)));
-  cpBodySetPosition(body, cpv(width/2.0, -height/2.0 + radius+5));
+  use_index(space, params);
 
-  shape = cpSpaceAddShape(space, cpCircleShapeNew(body, radius, cpvzero));
-  cpShapeSetElasticity(shape, 0.0f);
-  cpShapeSetFriction(shape, 0.9f);
+  // The rest of the context starts out zeroed, the same for every space, so
+  // replays line up.
+  ctx->mouse_body = cpBodyNewKinematic();
+  ctx->index      = params->index;
+  ctx->hash_steps = params->hash;
+  ctx->profile    = params->profile;
 
-  mouse_body = cpBodyNewKinematic();
+  ctx->step_budget    = params->step_budget;
+  ctx->min_iterations = cpfmax(params->min_iterations, 1);
+  ctx->max_iterations = cpfmax(params->max_iterations, ctx->min_iterations);
   
   return space;
 }
 
 void
 space_update(cpSpace *space, double dt) {
-  update_cursor();
-  cpSpaceStep(space, dt);
+  space_ctx *ctx = get_ctx(space);
+
+  update_cursor(ctx, dt);
+  capture_interp(space, ctx);
+
+  uint64_t start = ctx->step_budget > 0.0f ? step_now_ns() : 0;
+  if(ctx->profile && !ctx->hasty) {
+    step_profiled(space, dt, &ctx->stats);
+  } else if(ctx->profile) {
+    uint64_t t0 = step_now_ns();
+    cpHastySpaceStep(space, dt);
+    ctx->stats.total += step_now_ns() - t0;
+    ctx->stats.arbiters += space->arbiters->num;
+    ctx->stats.steps++;
+  } else if(ctx->hasty) {
+    cpHastySpaceStep(space, dt);
+  } else {
+    cpSpaceStep(space, dt);
+  }
+  ctx->step_index++;
+
+  if(ctx->step_budget > 0.0f) adapt_iterations(space, ctx, step_now_ns() - start);
+
+  if(ctx->hash_steps) ctx->state_hash = space_hash_state(space);
 }
 
 void
-space_destroy(cpSpace *space) {
-  freeSpaceChildren(space);
-  cpSpaceFree(space);
+space_get_stats(cpSpace *space, space_stats *out) {
+  *out = get_ctx(space)->stats;
 }
 
-static void 
-ShapeFreeWrap(cpSpace *space, cpShape *shape, void *unused){
+void
+space_reset_stats(cpSpace *space) {
+  memset(&get_ctx(space)->stats, 0, sizeof(space_stats));
+}
+
+uint64_t
+space_last_hash(cpSpace *space) {
+  return get_ctx(space)->state_hash;
+}
+
+space_index
+space_get_index(cpSpace *space) {
+  return get_ctx(space)->index;
+}
+
+void
+space_get_hash(cpSpace *space, cpFloat *dim, int *count) {
+  space_ctx *ctx = get_ctx(space);
+  *dim   = ctx->hash_dim;
+  *count = ctx->hash_count;
+}
+
+uint32_t
+space_step_index(cpSpace *space) {
+  return get_ctx(space)->step_index;
+}
+
+// STATIC GEOMETRY
+cpShape *
+space_add_static_shape(cpSpace *space, cpShape *shape) {
+  get_ctx(space)->static_version++;
+  return cpSpaceAddShape(space, shape);
+}
+
+void
+space_remove_static_shape(cpSpace *space, cpShape *shape) {
+  get_ctx(space)->static_version++;
   cpSpaceRemoveShape(space, shape);
-  cpShapeFree(shape);
 }
 
-static void 
-PostShapeFree(cpShape *shape, cpSpace *space){
-  cpSpaceAddPostStepCallback(space, (cpPostStepFunc)ShapeFreeWrap, shape, NULL);
+void
+space_reindex_static(cpSpace *space) {
+  get_ctx(space)->static_version++;
+  cpSpaceReindexStatic(space);
 }
 
-static void 
-ConstraintFreeWrap(cpSpace *space, cpConstraint *constraint, void *unused){
-  cpSpaceRemoveConstraint(space, constraint);
-  cpConstraintFree(constraint);
+uint32_t
+space_static_version(cpSpace *space) {
+  return get_ctx(space)->static_version;
 }
 
-static void 
-PostConstraintFree(cpConstraint *constraint, cpSpace *space){
-  cpSpaceAddPostStepCallback(space, (cpPostStepFunc)ConstraintFreeWrap, constraint, NULL);
+void
+space_destroy(cpSpace *space) {
+  space_ctx *ctx = get_ctx(space);
+
+  space_children children;
+  collectSpaceChildren(space, &children);
+
+  if(ctx->hasty) {
+    cpHastySpaceFree(space);
+  } else {
+    cpSpaceFree(space);
+  }
+  freeSpaceChildren(&children, ctx->arena);
+
+  // A pending grab was freed with the other constraints, so nothing points at
+  // the mouse body anymore. It was never added to the space.
+  ctx->mouse_joint = NULL;
+  cpBodyFree(ctx->mouse_body);
+
+  if(ctx->arena) scene_arena_destroy(ctx->arena);
+
+  free(ctx->interp);
+  free(ctx);
 }
 
-static void 
-BodyFreeWrap(cpSpace *space, cpBody *body, void *unused){
-  cpSpaceRemoveBody(space, body);
-  cpBodyFree(body);
+// SPATIAL INDEX
+#define TUNE_SAMPLES 1024
+
+typedef struct tune_sampler {
+  int      stride, seen, num;
+  cpFloat *extents;
+} tune_sampler;
+
+static void
+sample_extent(cpShape *shape, tune_sampler *sampler) {
+  if(sampler->seen++ % sampler->stride || sampler->num == TUNE_SAMPLES) return;
+
+  cpBB bb = shape->bb;
+  sampler->extents[sampler->num++] = cpfmax(bb.r - bb.l, bb.t - bb.b);
 }
 
-static void 
-PostBodyFree(cpBody *body, cpSpace *space){
-  cpSpaceAddPostStepCallback(space, (cpPostStepFunc)BodyFreeWrap, body, NULL);
+static int
+cmp_float(const void *a, const void *b) {
+  cpFloat x = *(const cpFloat *)a;
+  cpFloat y = *(const cpFloat *)b;
+  return (x > y) - (x < y);
+}
+
+void
+space_tune_hash(cpSpace *space, cpFloat *dim, int *count) {
+  int shapes = cpSpatialIndexCount(space->dynamicShapes);
+
+  cpFloat extents[TUNE_SAMPLES];
+  tune_sampler sampler = {shapes/TUNE_SAMPLES + 1, 0, 0, extents};
+  cpSpatialIndexEach(space->dynamicShapes, (cpSpatialIndexIteratorFunc)sample_extent, &sampler);
+
+  // The median ignores the odd huge or tiny shape that would skew a mean.
+  if(sampler.num > 0) {
+    qsort(extents, sampler.num, sizeof(cpFloat), cmp_float);
+    *dim = cpfmax(extents[sampler.num/2], 1.0f);
+  } else {
+    *dim = 32.0f;
+  }
+  *count = cpfmax(10*shapes, 1000);
 }
 
-// Safe and future proof way to remove and free all objects that have been added to the space.
 static void
-freeSpaceChildren(cpSpace *space) {
-  // Must remove these BEFORE freeing the body or you will access dangling pointers.
-  cpSpaceEachShape(space, (cpSpaceShapeIteratorFunc)PostShapeFree, space);
-  cpSpaceEachConstraint(space, (cpSpaceConstraintIteratorFunc)PostConstraintFree, space);
-  cpSpaceEachBody(space, (cpSpaceBodyIteratorFunc)PostBodyFree, space);
+copy_shape(cpShape *shape, cpSpatialIndex *index) {
+  cpSpatialIndexInsert(index, shape, shape->hashid);
+}
+
+static void
+use_index(cpSpace *space, const space_params *params) {
+  switch(params->index) {
+    case SPACE_INDEX_BBTREE:
+      break;
+
+    case SPACE_INDEX_HASH: {
+      cpFloat dim;
+      int count;
+      space_tune_hash(space, &dim, &count);
+      if(params->hash_dim   > 0.0f) dim   = params->hash_dim;
+      if(params->hash_count > 0   ) count = params->hash_count;
+      cpSpaceUseSpatialHash(space, dim, count);
+
+      space_ctx *ctx = get_ctx(space);
+      ctx->hash_dim   = dim;
+      ctx->hash_count = count;
+      break;
+    }
+
+    case SPACE_INDEX_SWEEP: {
+      // Chipmunk only has a setter for the hash, so swap the dynamic index by
+      // hand the same way cpSpaceUseSpatialHash does. Static shapes stay in
+      // the tree, which suits long walls better than a 1D sweep.
+      cpSpatialIndex *old = space->dynamicShapes;
+      space->staticShapes->dynamicIndex = NULL;
+
+      cpSpatialIndex *sweep = cpSweep1DNew((cpSpatialIndexBBFunc)cpShapeGetBB, space->staticShapes);
+      cpSpatialIndexEach(old, (cpSpatialIndexIteratorFunc)copy_shape, sweep);
+      cpSpatialIndexFree(old);
+      space->dynamicShapes = sweep;
+      break;
+    }
+  }
+}
+
+// ADAPTIVE ITERATIONS
+
+// Steps averaged before the iteration count changes. Long enough that one
+// slow step (a burst of new contacts, a page fault) doesn't cut iterations.
+#define ADAPT_WINDOW 8
+
+// Deepest overlap among the active contacts.
+static cpFloat
+max_penetration(cpSpace *space) {
+  cpFloat depth = 0.0f;
+  cpArray *arbiters = space->arbiters;
+  for(int i=0; i<arbiters->num; i++) {
+    cpArbiter *arb = (cpArbiter *)arbiters->arr[i];
+    for(int j=0; j<arb->count; j++) depth = cpfmax(depth, -cpArbiterGetDepth(arb, j));
+  }
+  return depth;
+}
+
+static void
+adapt_iterations(cpSpace *space, space_ctx *ctx, uint64_t ns) {
+  ctx->window_ns += ns;
+  if(++ctx->window_steps < ADAPT_WINDOW) return;
+
+  double avg    = (double)ctx->window_ns/ctx->window_steps;
+  double budget = ctx->step_budget*1e9;
+  ctx->window_ns    = 0;
+  ctx->window_steps = 0;
+
+  int iterations = space->iterations;
+  if(avg > budget) {
+    // Iterations aren't the whole step, so scaling them down by the overrun
+    // undershoots rather than overshoots; the next window takes the rest.
+    iterations = cpfmin(iterations - 1, iterations*budget/avg);
+  } else if(avg < 0.75*budget && max_penetration(space) > 2.0f*space->collisionSlop) {
+    iterations += cpfmax(1, iterations/4);
+  }
+  iterations = cpfclamp(iterations, ctx->min_iterations, ctx->max_iterations);
+  cpSpaceSetIterations(space, iterations);
+}
+
+// STATE HASH
+
+// Each record is folded into its own 64 bit value and the values are summed,
+// so the result doesn't depend on iteration order and stays cheap: one pass
+// over the bodies and the active arbiters.
+static inline uint64_t
+hash_mix(uint64_t h, uint64_t v) {
+  h ^= v;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  return h;
+}
+
+static inline uint64_t
+hash_float(uint64_t h, cpFloat f) {
+  uint64_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  return hash_mix(h, bits);
+}
+
+static void
+hash_body(cpBody *body, uint64_t *sum) {
+  if(cpBodyGetType(body) == CP_BODY_TYPE_STATIC) return;
+
+  uint64_t h = hash_mix(0x9e3779b97f4a7c15ull, space_body_key(body));
+  h = hash_float(h, body->p.x);
+  h = hash_float(h, body->p.y);
+  h = hash_float(h, body->v.x);
+  h = hash_float(h, body->v.y);
+  h = hash_float(h, body->a);
+  h = hash_float(h, body->w);
+  *sum += h;
+}
+
+uint64_t
+space_hash_state(cpSpace *space) {
+  uint64_t sum = 0;
+  cpSpaceEachBody(space, (cpSpaceBodyIteratorFunc)hash_body, &sum);
+
+  cpArray *arbiters = space->arbiters;
+  for(int i=0; i<arbiters->num; i++) {
+    cpArbiter *arb = (cpArbiter *)arbiters->arr[i];
+    uint64_t a = arb->a->hashid, b = arb->b->hashid;
+
+    uint64_t h = hash_mix(0xc2b2ae3d27d4eb4full, a < b ? (a << 32 | b) : (b << 32 | a));
+    for(int j=0; j<arb->count; j++) {
+      h = hash_float(h, arb->contacts[j].jnAcc);
+      h = hash_float(h, arb->contacts[j].jtAcc);
+    }
+    sum += h;
+  }
+
+  return sum;
+}
+
+// INTERPOLATION
+static void
+capture_interp(cpSpace *space, space_ctx *ctx) {
+  cpArray *bodies = space->dynamicBodies;
+
+  if(bodies->num > ctx->interp_max) {
+    ctx->interp_max = bodies->num*2;
+    ctx->interp = realloc(ctx->interp, sizeof(interp_state)*ctx->interp_max);
+  }
+
+  interp_state *interp = ctx->interp;
+  ctx->interp_num = bodies->num;
+  for(int i=0; i<ctx->interp_num; i++) {
+    cpBody *body = (cpBody *)bodies->arr[i];
+    interp[i].body = body;
+    interp[i].p    = body->p;
+    interp[i].a    = body->a;
+  }
+}
+
+static void
+recache_shapes(cpBody *body) {
+  CP_BODY_FOREACH_SHAPE(body, shape) cpShapeCacheBB(shape);
+}
+
+void
+space_set_transform(cpBody *body, cpVect p, cpFloat a) {
+  // Same layout as cpBody's own transform, around the center of gravity.
+  cpVect rot = cpvforangle(a);
+  cpVect c   = body->cog;
+  body->transform = cpTransformNewTranspose(
+    rot.x, -rot.y, p.x - (c.x*rot.x - c.y*rot.y),
+    rot.y,  rot.x, p.y - (c.x*rot.y + c.y*rot.x)
+  );
+  recache_shapes(body);
+}
+
+void
+space_interpolate(cpSpace *space, double alpha) {
+  space_ctx    *ctx    = get_ctx(space);
+  interp_state *interp = ctx->interp;
+  alpha = cpfclamp(alpha, 0.0, 1.0);
+
+  for(int i=0; i<ctx->interp_num; i++) {
+    cpBody *body = interp[i].body;
+    interp[i].transform = body->transform;
+
+    // The center of gravity and angle lerped between the previous and the
+    // current step.
+    cpVect  p = cpvlerp(interp[i].p, body->p, alpha);
+    cpFloat a = cpflerp(interp[i].a, body->a, alpha);
+    space_set_transform(body, p, a);
+  }
+}
+
+void
+space_interpolate_end(cpSpace *space) {
+  space_ctx    *ctx    = get_ctx(space);
+  interp_state *interp = ctx->interp;
+
+  for(int i=0; i<ctx->interp_num; i++) {
+    cpBody *body = interp[i].body;
+    body->transform = interp[i].transform;
+    recache_shapes(body);
+  }
+}
+
+// Tearing the space down object by object means a post-step callback and a
+// spatial index removal per shape, constraint and body. Nothing needs to be
+// removed when the whole space goes away, so collect the objects, free the
+// space with its indexes first, then release the objects directly.
+static void
+collect_child(void *obj, cpArray *arr) {
+  cpArrayPush(arr, obj);
+}
+
+static void
+collectSpaceChildren(cpSpace *space, space_children *children) {
+  children->shapes      = cpArrayNew(0);
+  children->constraints = cpArrayNew(0);
+  children->bodies      = cpArrayNew(0);
+
+  cpSpaceEachShape(space, (cpSpaceShapeIteratorFunc)collect_child, children->shapes);
+  cpSpaceEachConstraint(space, (cpSpaceConstraintIteratorFunc)collect_child, children->constraints);
+  cpSpaceEachBody(space, (cpSpaceBodyIteratorFunc)collect_child, children->bodies);
+}
+
+// Must run after the space is freed. Objects living in the scene arena are
+// only destroyed, their memory goes with the arena.
+static void
+freeSpaceChildren(space_children *children, scene_arena *arena) {
+  for(int i=0; i<children->shapes->num; i++) {
+    cpShape *shape = (cpShape *)children->shapes->arr[i];
+    if(arena && arena_owns(arena->shapes, shape)) {
+      cpShapeDestroy(shape);
+    } else {
+      cpShapeFree(shape);
+    }
+  }
+
+  for(int i=0; i<children->constraints->num; i++) {
+    cpConstraintFree((cpConstraint *)children->constraints->arr[i]);
+  }
+
+  for(int i=0; i<children->bodies->num; i++) {
+    cpBody *body = (cpBody *)children->bodies->arr[i];
+    if(arena && arena_owns(arena->bodies, body)) {
+      cpBodyDestroy(body);
+    } else {
+      cpBodyFree(body);
+    }
+  }
+
+  cpArrayFree(children->shapes);
+  cpArrayFree(children->constraints);
+  cpArrayFree(children->bodies);
+}
+
+// CONTACTS
+
+// Runs on the step thread for every arbiter after the solver; only appends
+// to the rings so the step isn't held up by whatever consumes the events.
+static void
+contact_post_solve(cpArbiter *arb, cpSpace *space, cpDataPointer data) {
+  space_ctx *ctx = data;
+  if(ctx->num_rings == 0 || !cpArbiterIsFirstContact(arb)) return;
+
+  CP_ARBITER_GET_SHAPES(arb, a, b);
+  cpVect p = cpArbiterGetPointA(arb, 0);
+  cpVect n = cpArbiterGetNormal(arb);
+
+  contact_event event;
+  event.step    = ctx->step_index;
+  event.a       = (uint32_t)a->hashid;
+  event.b       = (uint32_t)b->hashid;
+  event.px      = (float)p.x;
+  event.py      = (float)p.y;
+  event.nx      = (float)n.x;
+  event.ny      = (float)n.y;
+  event.impulse = (float)cpvlength(cpArbiterTotalImpulse(arb));
+
+  for(int i=0; i<ctx->num_rings; i++) contact_ring_push(ctx->rings[i], &event);
+}
+
+int
+space_add_contact_ring(cpSpace *space, contact_ring *ring) {
+  space_ctx *ctx = get_ctx(space);
+  if(ctx->num_rings == SPACE_CONTACT_RINGS) return 0;
+
+  if(ctx->num_rings == 0) {
+    cpCollisionHandler *handler = cpSpaceAddDefaultCollisionHandler(space);
+    handler->postSolveFunc = contact_post_solve;
+    handler->userData      = ctx;
+  }
+  ctx->rings[ctx->num_rings++] = ring;
+  return 1;
+}
+
+void
+space_remove_contact_ring(cpSpace *space, contact_ring *ring) {
+  space_ctx *ctx = get_ctx(space);
+  for(int i=0; i<ctx->num_rings; i++) {
+    if(ctx->rings[i] == ring) {
+      ctx->rings[i] = ctx->rings[--ctx->num_rings];
+      return;
+    }
+  }
 }
 
 // EVENTS
+void
+space_record(cpSpace *space, replay_log *log) {
+  get_ctx(space)->recorder = log;
+}
+
 void
 space_mouse_down(cpSpace* space) {
+  space_ctx *ctx = get_ctx(space);
+  if(ctx->recorder) replay_push(ctx->recorder, ctx->step_index, REPLAY_MOUSE_DOWN, 0, 0);
 
   // give the mouse click a little radius to make it easier to click small shapes.
   cpFloat radius = 5.0;
   
   cpPointQueryInfo info = {};
-  cpShape *shape = cpSpacePointQueryNearest(space, mouse_pnt, radius, GRAB_FILTER, &info);
+  cpShape *shape = cpSpacePointQueryNearest(space, ctx->mouse_pnt, radius, GRAB_FILTER, &info);
   
   if(shape && cpBodyGetMass(cpShapeGetBody(shape)) < INFINITY){
     // Use the closest point on the surface if the click is outside of the shape.
-    cpVect nearest = (info.distance > 0.0f ? info.point : mouse_pnt);
+    cpVect nearest = (info.distance > 0.0f ? info.point : ctx->mouse_pnt);
     
     cpBody *body = cpShapeGetBody(shape);
-    mouse_joint = cpPivotJointNew2(mouse_body, body, cpvzero, cpBodyWorldToLocal(body, nearest));
-    mouse_joint->maxForce = 50000.0f;
-    mouse_joint->errorBias = cpfpow(1.0f - 0.15f, 60.0f);
-    cpSpaceAddConstraint(space, mouse_joint);
+    ctx->mouse_joint = cpPivotJointNew2(ctx->mouse_body, body, cpvzero, cpBodyWorldToLocal(body, nearest));
+    ctx->mouse_joint->maxForce = 50000.0f;
+    ctx->mouse_joint->errorBias = cpfpow(1.0f - 0.15f, 60.0f);
+    cpSpaceAddConstraint(space, ctx->mouse_joint);
   }
 }
 
 void
 space_mouse_up(cpSpace* space) {
-  if(mouse_joint){
-    cpSpaceRemoveConstraint(space, mouse_joint);
-    cpConstraintFree(mouse_joint);
-    mouse_joint = NULL;
+  space_ctx *ctx = get_ctx(space);
+  if(ctx->recorder) replay_push(ctx->recorder, ctx->step_index, REPLAY_MOUSE_UP, 0, 0);
+  if(ctx->mouse_joint){
+    cpSpaceRemoveConstraint(space, ctx->mouse_joint);
+    cpConstraintFree(ctx->mouse_joint);
+    ctx->mouse_joint = NULL;
   }
 }
 
 void
 space_mouse_move(cpSpace* space, int x, int y) {
-  mouse_pnt.x = x;
-  mouse_pnt.y = y;
+  space_ctx *ctx = get_ctx(space);
+  if(ctx->recorder) replay_push(ctx->recorder, ctx->step_index, REPLAY_MOUSE_MOVE, x, y);
+  ctx->mouse_pnt.x = x;
+  ctx->mouse_pnt.y = y;
 }
 
 static void 
-update_cursor() {
-  cpVect new_point = cpvlerp(mouse_body->p, mouse_pnt, 0.25f);
-  mouse_body->v = cpvmult(cpvsub(new_point, mouse_body->p), 60.0f);
+update_cursor(space_ctx *ctx, double dt) {
+  cpBody *mouse_body = ctx->mouse_body;
+  cpVect new_point = cpvlerp(mouse_body->p, ctx->mouse_pnt, 0.25f);
+  mouse_body->v = cpvmult(cpvsub(new_point, mouse_body->p), 1.0f/dt);
   mouse_body->p = new_point;
 }
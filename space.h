@@ -1,14 +1,159 @@
 #pragma once
 
+#include <stdint.h>
+
 #include <chipmunk/chipmunk_private.h>
 #include <chipmunk/chipmunk.h>
+#include <chipmunk/cpHastySpace.h>
+
+#include "scene.h"
 
 #define GRABBABLE_MASK_BIT (1<<31)
 
+extern cpShapeFilter GRAB_FILTER;
+extern cpShapeFilter NOT_GRABBABLE_FILTER;
+
+typedef enum space_index {
+  SPACE_INDEX_BBTREE,  // Chipmunk's default AABB tree
+  SPACE_INDEX_HASH,    // cpSpaceUseSpatialHash
+  SPACE_INDEX_SWEEP,   // 1D sort and sweep for the dynamic shapes
+} space_index;
+
+// Time spent in each phase of the step in ns, summed over the steps since the
+// last reset. A hasty space steps through cpHastySpaceStep, which can't be
+// split into phases, and only reports total.
+typedef struct space_stats {
+  uint64_t steps;
+  uint64_t broadphase;   // shape BB updates and spatial index reindex/query
+  uint64_t narrowphase;  // collision tests of the candidate pairs
+  uint64_t sleep;        // contact graph and sleeping components
+  uint64_t prestep;      // arbiter and constraint prestep, warm starting
+  uint64_t solver;       // impulse iterations
+  uint64_t integrate;    // position and velocity integration
+  uint64_t callbacks;    // post-solve and post-step callbacks
+  uint64_t total;
+  uint64_t pairs;        // candidate pairs out of the broadphase
+  uint64_t arbiters;     // active arbiters
+} space_stats;
+
+typedef struct space_params {
+  scene_params scene;
+  int          threads;     // 0: plain cpSpace, N: cpHastySpace stepping on N threads
+  space_index  index;
+  cpFloat      hash_dim;    // spatial hash cell size, 0 to tune from the scene
+  int          hash_count;  // spatial hash table size, 0 to tune from the scene
+  int          arena;       // build bodies and shapes into contiguous arenas
+  int          hash;        // hash the world state after every step
+  int          profile;     // collect per-phase timings into space_stats
+
+  // Adaptive solver iterations: with a budget, the iteration count is
+  // adjusted every few steps between min and max so the measured step time
+  // stays under budget, and raised while there is time left and contacts
+  // still penetrate past the collision slop. Timing dependent, so runs with
+  // a budget don't replay or hash the same twice.
+  cpFloat      step_budget;  // seconds per step, 0 keeps 5 iterations
+  int          min_iterations;
+  int          max_iterations;
+} space_params;
+
+void      space_params_default(space_params *params);
+
+// Suggest spatial hash parameters from the bounding boxes of the dynamic
+// shapes already in the space: cells about the size of a typical shape and
+// roughly ten cells per shape.
+void      space_tune_hash(cpSpace *space, cpFloat *dim, int *count);
+
+// Each space carries its own state (input, step counter, stats) in its user
+// data, which is therefore not free for other uses. Separate spaces share
+// nothing and can be stepped concurrently from different threads.
 cpSpace * space_init(int width, int height);
+cpSpace * space_new (int width, int height, const space_params *params);
 void      space_update(cpSpace *space, double dt);
 void      space_destroy(cpSpace *space);
 
+// Draw at a fraction alpha in [0, 1] between the previous and the current
+// step. Every call must be paired with space_interpolate_end before stepping.
+void space_interpolate    (cpSpace *space, double alpha);
+void space_interpolate_end(cpSpace *space);
+
+// Set body->transform the way cpBody does for its center of gravity at p and
+// angle a, without touching the body's position, and recache the bounding
+// boxes of its shapes.
+void space_set_transform  (cpBody *body, cpVect p, cpFloat a);
+
+// Write the dynamic state of the space (bodies and their sleep state, shapes,
+// constraints and all arbiters with their warm-start impulses) into buf.
+// Returns the snapshot size; nothing usable is written when it is larger
+// than size. Returns 0 when out of memory.
+size_t space_snapshot(cpSpace *space, void *buf, size_t size);
+
+// Put a snapshot back into a space holding the same objects, e.g. the same
+// scene rebuilt from the same params. Arbiters are recreated and the space is
+// laid out in key order, so stepping on from a restore is repeatable.
+// Returns cpFalse, leaving the space untouched, if it doesn't match.
+cpBool space_restore (cpSpace *space, const void *buf, size_t size);
+
+// Stable identity of a body across sleep/wake reordering and across rebuilds
+// of the same scene: the hashid of its most recently added shape, plus one.
+// Bodies without shapes get 0.
+static inline uint64_t
+space_body_key(const cpBody *body) {
+  return body->shapeList ? (uint64_t)body->shapeList->hashid + 1 : 0;
+}
+
+// Order independent hash of body positions, velocities, angles and contact
+// impulses. Equal states hash equal whatever order Chipmunk keeps its arrays
+// in, so runs can be compared across builds, thread counts and flags.
+uint64_t space_hash_state(cpSpace *space);
+
+// Hash after the most recent step when built with params->hash, else 0.
+uint64_t space_last_hash(cpSpace *space);
+
+void space_get_stats  (cpSpace *space, space_stats *stats);
+void space_reset_stats(cpSpace *space);
+
+space_index space_get_index(cpSpace *space);
+
+// Cell size and table size of the spatial hash as built, tuned or given in
+// params; both 0 unless the space uses SPACE_INDEX_HASH.
+void        space_get_hash (cpSpace *space, cpFloat *dim, int *count);
+
+// Number of steps taken since the space was built.
+uint32_t space_step_index(cpSpace *space);
+
+// Static geometry goes through these instead of cpSpaceAddShape,
+// cpSpaceRemoveShape and cpSpaceReindexStatic so the version changes with
+// it, letting a renderer keep the static shapes drawn once until then.
+// Shapes must be attached to a static body; not to be called during a step.
+cpShape *space_add_static_shape   (cpSpace *space, cpShape *shape);
+void     space_remove_static_shape(cpSpace *space, cpShape *shape);
+void     space_reindex_static     (cpSpace *space);
+uint32_t space_static_version     (cpSpace *space);
+
+// Append every space_mouse_* call to log, tagged with the current step, until
+// called again with NULL. See replay.h.
+struct replay_log;
+void space_record(cpSpace *space, struct replay_log *log);
+
+// Stream every new contact of the space into ring from its default collision
+// handler (see contact.h). Up to SPACE_CONTACT_RINGS rings, one per consumer,
+// can be attached at once; returns 0 when they are all taken.
+#define SPACE_CONTACT_RINGS 4
+struct contact_ring;
+int  space_add_contact_ring   (cpSpace *space, struct contact_ring *ring);
+void space_remove_contact_ring(cpSpace *space, struct contact_ring *ring);
+
+// Batched versions of cpSpaceSegmentQueryFirst and cpSpacePointQueryNearest
+// for many sensors at once: query i fills out[i], with a NULL shape when
+// nothing was found. With a pool the queries are spread over its threads;
+// the space must not be stepped or changed meanwhile. Spatial hash queries
+// write to the hash, so with SPACE_INDEX_HASH they always run serially.
+struct pool;
+void space_segment_query_batch(cpSpace *space, struct pool *pool, const cpVect *start, const cpVect *end, int count,
+                               cpFloat radius, cpShapeFilter filter, cpSegmentQueryInfo *out);
+void space_point_query_batch  (cpSpace *space, struct pool *pool, const cpVect *points, int count,
+                               cpFloat max_distance, cpShapeFilter filter, cpPointQueryInfo *out);
+
 void space_mouse_move(cpSpace* space, int x, int y);
 void space_mouse_down(cpSpace* space);
-void space_mouse_up  (cpSpace* space);
\ No newline at end of file
+void space_mouse_up  (cpSpace* space);
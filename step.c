@@ -0,0 +1,167 @@
+#include <time.h>
+
+#include "step.h"
+
+// Mirrors cpSpaceStep from Chipmunk 7 using the functions chipmunk_private.h
+// exposes, so each phase can be timed. Keep it in sync when updating
+// Chipmunk.
+
+uint64_t
+step_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+typedef struct collide_context {
+  cpSpace     *space;
+  space_stats *stats;
+} collide_context;
+
+// Narrowphase runs from inside the broadphase query, so it is timed per
+// pair and taken out of the broadphase total afterwards. The two clock reads
+// per pair add a little to the step while profiling.
+static cpCollisionID
+collide_timed(cpShape *a, cpShape *b, cpCollisionID id, collide_context *context) {
+  uint64_t t0 = step_now_ns();
+  id = cpSpaceCollideShapes(a, b, id, context->space);
+  context->stats->narrowphase += step_now_ns() - t0;
+  context->stats->pairs++;
+  return id;
+}
+
+void
+step_profiled(cpSpace *space, cpFloat dt, space_stats *stats) {
+  // don't step if the timestep is 0!
+  if(dt == 0.0f) return;
+
+  uint64_t start = step_now_ns(), t0, t1;
+
+  space->stamp++;
+
+  cpFloat prev_dt = space->curr_dt;
+  space->curr_dt = dt;
+
+  cpArray *bodies = space->dynamicBodies;
+  cpArray *constraints = space->constraints;
+  cpArray *arbiters = space->arbiters;
+
+  // Reset and empty the arbiter lists.
+  for(int i=0; i<arbiters->num; i++){
+    cpArbiter *arb = (cpArbiter *)arbiters->arr[i];
+    arb->state = CP_ARBITER_STATE_NORMAL;
+
+    // If both bodies are awake, unthread the arbiter from the contact graph.
+    if(!cpBodyIsSleeping(arb->body_a) && !cpBodyIsSleeping(arb->body_b)){
+      cpArbiterUnthread(arb);
+    }
+  }
+  arbiters->num = 0;
+
+  cpSpaceLock(space); {
+    // Integrate positions
+    t0 = step_now_ns();
+    for(int i=0; i<bodies->num; i++){
+      cpBody *body = (cpBody *)bodies->arr[i];
+      body->position_func(body, dt);
+    }
+    t1 = step_now_ns();
+    stats->integrate += t1 - t0;
+
+    // Find colliding pairs.
+    uint64_t narrow = stats->narrowphase;
+    collide_context context = {space, stats};
+    cpSpacePushFreshContactBuffer(space);
+    cpSpatialIndexEach(space->dynamicShapes, (cpSpatialIndexIteratorFunc)cpShapeUpdateFunc, NULL);
+    cpSpatialIndexReindexQuery(space->dynamicShapes, (cpSpatialIndexQueryFunc)collide_timed, &context);
+    t0 = step_now_ns();
+    stats->broadphase += (t0 - t1) - (stats->narrowphase - narrow);
+  } cpSpaceUnlock(space, cpFalse);
+
+  // Rebuild the contact graph (and detect sleeping components if sleeping is enabled)
+  cpSpaceProcessComponents(space, dt);
+  t1 = step_now_ns();
+  stats->sleep += t1 - t0;
+
+  cpSpaceLock(space); {
+    // Clear out old cached arbiters and call separate callbacks
+    cpHashSetFilter(space->cachedArbiters, (cpHashSetFilterFunc)cpSpaceArbiterSetFilter, space);
+
+    // Prestep the arbiters and constraints.
+    cpFloat slop = space->collisionSlop;
+    cpFloat biasCoef = 1.0f - cpfpow(space->collisionBias, dt);
+    for(int i=0; i<arbiters->num; i++){
+      cpArbiterPreStep((cpArbiter *)arbiters->arr[i], dt, slop, biasCoef);
+    }
+
+    for(int i=0; i<constraints->num; i++){
+      cpConstraint *constraint = (cpConstraint *)constraints->arr[i];
+
+      cpConstraintPreSolveFunc preSolve = constraint->preSolve;
+      if(preSolve) preSolve(constraint, space);
+
+      constraint->klass->preStep(constraint, dt);
+    }
+    t0 = step_now_ns();
+    stats->prestep += t0 - t1;
+
+    // Integrate velocities.
+    cpFloat damping = cpfpow(space->damping, dt);
+    cpVect gravity = space->gravity;
+    for(int i=0; i<bodies->num; i++){
+      cpBody *body = (cpBody *)bodies->arr[i];
+      body->velocity_func(body, gravity, damping, dt);
+    }
+    t1 = step_now_ns();
+    stats->integrate += t1 - t0;
+
+    // Apply cached impulses
+    cpFloat dt_coef = (prev_dt == 0.0f ? 0.0f : dt/prev_dt);
+    for(int i=0; i<arbiters->num; i++){
+      cpArbiterApplyCachedImpulse((cpArbiter *)arbiters->arr[i], dt_coef);
+    }
+
+    for(int i=0; i<constraints->num; i++){
+      cpConstraint *constraint = (cpConstraint *)constraints->arr[i];
+      constraint->klass->applyCachedImpulse(constraint, dt_coef);
+    }
+    t0 = step_now_ns();
+    stats->prestep += t0 - t1;
+
+    // Run the impulse solver.
+    for(int i=0; i<space->iterations; i++){
+      for(int j=0; j<arbiters->num; j++){
+        cpArbiterApplyImpulse((cpArbiter *)arbiters->arr[j]);
+      }
+
+      for(int j=0; j<constraints->num; j++){
+        cpConstraint *constraint = (cpConstraint *)constraints->arr[j];
+        constraint->klass->applyImpulse(constraint, dt);
+      }
+    }
+    t1 = step_now_ns();
+    stats->solver += t1 - t0;
+
+    // Run the constraint post-solve callbacks
+    for(int i=0; i<constraints->num; i++){
+      cpConstraint *constraint = (cpConstraint *)constraints->arr[i];
+
+      cpConstraintPostSolveFunc postSolve = constraint->postSolve;
+      if(postSolve) postSolve(constraint, space);
+    }
+
+    // run the post-solve callbacks
+    for(int i=0; i<arbiters->num; i++){
+      cpArbiter *arb = (cpArbiter *) arbiters->arr[i];
+
+      cpCollisionHandler *handler = arb->handler;
+      handler->postSolveFunc(arb, space, handler->userData);
+    }
+  } cpSpaceUnlock(space, cpTrue);
+
+  t0 = step_now_ns();
+  stats->callbacks += t0 - t1;
+  stats->total     += t0 - start;
+  stats->arbiters  += arbiters->num;
+  stats->steps++;
+}
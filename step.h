@@ -0,0 +1,8 @@
+#pragma once
+
+#include "space.h"
+
+// cpSpaceStep, phase for phase, with a clock around each phase.
+void step_profiled(cpSpace *space, cpFloat dt, space_stats *stats);
+
+uint64_t step_now_ns(void);